@@ -58,6 +58,8 @@ public:
 	virtual void Resize(uint width, uint height) = 0;
 	virtual void DrawScreen(const Region& region) = 0;
 	virtual void SetPalette(uint index, uint nents, const Palette* pal) = 0;
+	// ライン top[i] 以降に pal[i * nents] からのパレットを使う (未対応なら false)
+	virtual bool SetRasterPalette(uint nbands, const int* top, uint index, uint nents, const Palette* pal) { return false; }
 	virtual void Flip() {}
 	virtual bool SetFlipMode(bool) = 0;
 };
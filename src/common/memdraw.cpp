@@ -0,0 +1,352 @@
+﻿// ---------------------------------------------------------------------------
+//	M88 - PC-8801 Emulator.
+// ---------------------------------------------------------------------------
+//	メモリ上の画面イメージへの描画
+// ---------------------------------------------------------------------------
+
+#include "headers.h"
+#include "memdraw.h"
+#include "file.h"
+#include "misc.h"
+#include "zlib/zlib.h"
+
+#define LOGNAME "memdraw"
+#include "diag.h"
+
+// ---------------------------------------------------------------------------
+//	構築/消滅
+//
+MemoryDraw::MemoryDraw()
+: image(0), width(0), height(0), status(0), changed(true), nbands(0),
+  framecount(0), framehash(0), dumpnext(0), dumpinterval(0), dumpformat(bmp)
+{
+	memset(palette, 0, sizeof(palette));
+	dumppattern[0] = 0;
+}
+
+MemoryDraw::~MemoryDraw()
+{
+	Cleanup();
+}
+
+// ---------------------------------------------------------------------------
+//	初期化
+//	bpp は 8 のみ
+//
+bool MemoryDraw::Init(uint w, uint h, uint bpp)
+{
+	if (bpp != 8)
+		return false;
+	return Alloc(w, h);
+}
+
+bool MemoryDraw::Cleanup()
+{
+	delete[] image;
+	image = 0;
+	return true;
+}
+
+bool MemoryDraw::Alloc(uint w, uint h)
+{
+	delete[] image;
+	image = new uint8[w * h];
+	if (!image)
+	{
+		width = height = 0;
+		return false;
+	}
+	width = w;
+	height = h;
+	memset(image, 0x40, w * h);
+	status |= shouldrefresh;
+	changed = true;
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+//	画面サイズを変える
+//
+void MemoryDraw::Resize(uint w, uint h)
+{
+	if (w != width || h != height)
+		Alloc(w, h);
+}
+
+// ---------------------------------------------------------------------------
+//	画面イメージの使用
+//
+bool MemoryDraw::Lock(uint8** pimage, int* pbpl)
+{
+	*pimage = image;
+	*pbpl = width;
+	return image != 0;
+}
+
+bool MemoryDraw::Unlock()
+{
+	status &= ~shouldrefresh;
+	return true;
+}
+
+uint MemoryDraw::GetStatus()
+{
+	return image ? (status | readytodraw) : 0;
+}
+
+// ---------------------------------------------------------------------------
+//	パレット設定
+//
+void MemoryDraw::SetPalette(uint index, uint nents, const Palette* pal)
+{
+	assert(index + nents <= 0x100);
+	memcpy(palette + index, pal, nents * sizeof(Palette));
+	changed = true;
+}
+
+// ---------------------------------------------------------------------------
+//	帯ごとのパレット設定
+//	top[i] 以降のラインに pal[i * nents] からのパレットを使う
+//
+bool MemoryDraw::SetRasterPalette(uint n, const int* top, uint index, uint nents, const Palette* pal)
+{
+	assert(index + nents <= 0x100);
+	if (n > maxbands)
+		return false;
+	for (uint i=0; i<n; i++)
+	{
+		bandtop[i] = top[i];
+		memcpy(bandpal[i], palette, sizeof(palette));
+		memcpy(bandpal[i] + index, pal + i * nents, nents * sizeof(Palette));
+	}
+	nbands = n;
+	changed = true;
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+//	1 フレーム分の描画
+//	画面が変わった時だけハッシュを計算し直す
+//
+void MemoryDraw::DrawScreen(const Region& region)
+{
+	if (!image)
+		return;
+	if (region.top <= region.bottom || changed)
+	{
+		changed = false;
+		framehash = CalcHash();
+	}
+
+	if (dumppattern[0] && framecount == dumpnext)
+	{
+		char filename[sizeof(dumppattern) + 16];
+		sprintf(filename, dumppattern, framecount);
+		if (!DumpFrame(filename, dumpformat))
+			LOG1("dump failed: %s\n", filename);
+		if (dumpinterval)
+			dumpnext += dumpinterval;
+		else
+			dumppattern[0] = 0;
+	}
+	framecount++;
+}
+
+// ---------------------------------------------------------------------------
+//	ラインに使うパレット
+//
+inline const Draw::Palette* MemoryDraw::GetLinePalette(uint y)
+{
+	if (!nbands)
+		return palette;
+	int i;
+	for (i=nbands-1; i>0 && int(y) < bandtop[i]; i--)
+		;
+	return bandpal[i];
+}
+
+// ---------------------------------------------------------------------------
+//	表示される色から 64 bit ハッシュ (FNV-1a) を求める
+//
+uint64 MemoryDraw::CalcHash()
+{
+	const uint64 prime = 0x100000001b3ULL;
+	uint64 h = 0xcbf29ce484222325ULL;
+	h = (h ^ width) * prime;
+	h = (h ^ height) * prime;
+
+	uint32 ctable[0x100];
+	const Palette* cur = 0;
+	const uint8* src = image;
+	for (uint y=0; y<height; y++, src+=width)
+	{
+		const Palette* pal = GetLinePalette(y);
+		if (pal != cur)
+		{
+			for (int i=0; i<0x100; i++)
+				ctable[i] = pal[i].red | (pal[i].green << 8) | (pal[i].blue << 16);
+			cur = pal;
+		}
+		for (uint x=0; x<width; x++)
+			h = (h ^ ctable[src[x]]) * prime;
+	}
+	return h;
+}
+
+// ---------------------------------------------------------------------------
+//	書き出すフレームの指定
+//	pattern に %u を含めるとフレーム番号に置き換えられる
+//	interval が 0 なら first 番目のフレームだけを書き出す
+//
+void MemoryDraw::SetDumpFrames(const char* pattern, uint first, uint interval, Format format)
+{
+	dumppattern[0] = 0;
+	if (pattern && strlen(pattern) < sizeof(dumppattern))
+		strcpy(dumppattern, pattern);
+	dumpnext = first;
+	dumpinterval = interval;
+	dumpformat = format;
+}
+
+// ---------------------------------------------------------------------------
+//	現在の画面をファイルに書き出す
+//
+bool MemoryDraw::DumpFrame(const char* filename, Format format)
+{
+	if (!image)
+		return false;
+	return format == png ? WritePNG(filename) : WriteBMP(filename);
+}
+
+// ---------------------------------------------------------------------------
+//	24bpp (B, G, R の順) に変換
+//	BMP では各ラインを 4 byte 境界に揃え，下のラインから並べる
+//
+void MemoryDraw::MakeRGB(uint8* dest, bool bottomup, uint pad)
+{
+	for (uint i=0; i<height; i++)
+	{
+		uint y = bottomup ? height-1-i : i;
+		const Palette* pal = GetLinePalette(y);
+		const uint8* src = image + y * width;
+		for (uint x=0; x<width; x++)
+		{
+			const Palette& c = pal[src[x]];
+			if (bottomup)
+				dest[0] = c.blue, dest[1] = c.green, dest[2] = c.red;
+			else
+				dest[0] = c.red, dest[1] = c.green, dest[2] = c.blue;
+			dest += 3;
+		}
+		for (uint p=0; p<pad; p++)
+			*dest++ = 0;
+	}
+}
+
+static inline void PutLE16(uint8* p, uint v)
+{
+	p[0] = uint8(v), p[1] = uint8(v >> 8);
+}
+
+static inline void PutLE32(uint8* p, uint32 v)
+{
+	p[0] = uint8(v), p[1] = uint8(v >> 8), p[2] = uint8(v >> 16), p[3] = uint8(v >> 24);
+}
+
+static inline void PutBE32(uint8* p, uint32 v)
+{
+	p[0] = uint8(v >> 24), p[1] = uint8(v >> 16), p[2] = uint8(v >> 8), p[3] = uint8(v);
+}
+
+// ---------------------------------------------------------------------------
+//	BMP (24bpp 非圧縮)
+//
+bool MemoryDraw::WriteBMP(const char* filename)
+{
+	uint bpl = (width * 3 + 3) & ~3;
+	uint imagesize = bpl * height;
+	uint8 hdr[54];
+	memset(hdr, 0, sizeof(hdr));
+	
+	// BITMAPFILEHEADER
+	hdr[0] = 'B', hdr[1] = 'M';
+	PutLE32(hdr +  2, sizeof(hdr) + imagesize);
+	PutLE32(hdr + 10, sizeof(hdr));
+	// BITMAPINFOHEADER
+	PutLE32(hdr + 14, 40);
+	PutLE32(hdr + 18, width);
+	PutLE32(hdr + 22, height);
+	PutLE16(hdr + 26, 1);
+	PutLE16(hdr + 28, 24);
+	PutLE32(hdr + 34, imagesize);
+
+	uint8* buf = new uint8[imagesize];
+	if (!buf)
+		return false;
+	MakeRGB(buf, true, bpl - width * 3);
+
+	FileIO file;
+	bool r = file.Open(filename, FileIO::create)
+		&& file.Write(hdr, sizeof(hdr)) == sizeof(hdr)
+		&& file.Write(buf, imagesize) == int32(imagesize);
+	delete[] buf;
+	return r;
+}
+
+// ---------------------------------------------------------------------------
+//	PNG (24bpp)
+//
+static bool WritePNGChunk(FileIO& file, const char* type, const uint8* data, uint32 len)
+{
+	uint8 hdr[8], crc[4];
+	PutBE32(hdr, len);
+	memcpy(hdr + 4, type, 4);
+	uLong c = crc32(0, hdr + 4, 4);
+	if (len)
+		c = crc32(c, data, len);
+	PutBE32(crc, c);
+	return file.Write(hdr, 8) == 8
+		&& (!len || file.Write(data, len) == int32(len))
+		&& file.Write(crc, 4) == 4;
+}
+
+bool MemoryDraw::WritePNG(const char* filename)
+{
+	static const uint8 signature[8] = { 0x89, 'P', 'N', 'G', 0x0d, 0x0a, 0x1a, 0x0a };
+
+	// 各ラインの先頭にフィルタ種別 (0: なし) を置く
+	uint bpl = width * 3 + 1;
+	uLong rawsize = bpl * height;
+	uint8* raw = new uint8[rawsize];
+	if (!raw)
+		return false;
+	MakeRGB(raw, false, 0);
+	for (uint y=height; y>0; y--)
+	{
+		memmove(raw + (y-1) * bpl + 1, raw + (y-1) * (bpl-1), bpl-1);
+		raw[(y-1) * bpl] = 0;
+	}
+
+	uLong zsize = compressBound(rawsize);
+	uint8* z = new uint8[zsize];
+	bool r = false;
+	if (z && Z_OK == compress2(z, &zsize, raw, rawsize, Z_BEST_SPEED))
+	{
+		uint8 ihdr[13];
+		PutBE32(ihdr, width);
+		PutBE32(ihdr + 4, height);
+		ihdr[8] = 8;		// bit depth
+		ihdr[9] = 2;		// truecolor
+		ihdr[10] = ihdr[11] = ihdr[12] = 0;
+
+		FileIO file;
+		r = file.Open(filename, FileIO::create)
+			&& file.Write(signature, 8) == 8
+			&& WritePNGChunk(file, "IHDR", ihdr, 13)
+			&& WritePNGChunk(file, "IDAT", z, zsize)
+			&& WritePNGChunk(file, "IEND", 0, 0);
+	}
+	delete[] z;
+	delete[] raw;
+	return r;
+}
@@ -0,0 +1,85 @@
+﻿// ---------------------------------------------------------------------------
+//	M88 - PC-8801 Emulator.
+// ---------------------------------------------------------------------------
+//	メモリ上の画面イメージへの描画
+// ---------------------------------------------------------------------------
+
+#pragma once
+
+#include "types.h"
+#include "draw.h"
+
+// ---------------------------------------------------------------------------
+//	MemoryDraw
+//
+//	画面イメージ (8bpp) とパレットをメモリ上に持つだけの Draw．
+//	表示装置を使わないので，画面の確認や速度測定をバッチで行う時に使う．
+//	フレームごとに表示される色 (パレット適用後) の 64 bit ハッシュを求め，
+//	指定したフレームを BMP (非圧縮) または PNG で書き出せる．
+//
+class MemoryDraw : public Draw
+{
+public:
+	enum Format
+	{
+		bmp = 0,		// 24bpp 非圧縮
+		png,			// 24bpp
+	};
+
+public:
+	MemoryDraw();
+	~MemoryDraw();
+
+// - Draw Common Interface
+	bool Init(uint width, uint height, uint bpp);
+	bool Cleanup();
+
+	bool Lock(uint8** pimage, int* pbpl);
+	bool Unlock();
+
+	uint GetStatus();
+	void Resize(uint width, uint height);
+	void DrawScreen(const Region& region);
+	void SetPalette(uint index, uint nents, const Palette* pal);
+	bool SetRasterPalette(uint nbands, const int* top, uint index, uint nents, const Palette* pal);
+	bool SetFlipMode(bool) { return false; }
+
+// - Unique Interface
+	uint GetFrameCount() { return framecount; }
+	uint64 GetFrameHash() { return framehash; }
+	bool DumpFrame(const char* filename, Format format);
+	void SetDumpFrames(const char* pattern, uint first, uint interval, Format format);
+
+private:
+	enum
+	{
+		maxbands = 16,
+	};
+
+	bool Alloc(uint width, uint height);
+	const Palette* GetLinePalette(uint y);
+	uint64 CalcHash();
+	void MakeRGB(uint8* dest, bool bottomup, uint pad);
+	bool WriteBMP(const char* filename);
+	bool WritePNG(const char* filename);
+
+	uint8* image;
+	uint width;
+	uint height;
+	uint status;
+	bool changed;					// 前回のハッシュ計算から画面が変わった
+
+	Palette palette[0x100];
+	int nbands;						// 帯ごとのパレットの数 (0 なら使わない)
+	int bandtop[maxbands];
+	Palette bandpal[maxbands][0x100];
+
+	uint framecount;
+	uint64 framehash;
+
+	char dumppattern[256];			// 書き出すファイル名 (%u にフレーム番号)
+	uint dumpnext;					// 次に書き出すフレーム
+	uint dumpinterval;				// 0 なら 1 回だけ
+	Format dumpformat;
+};
+
@@ -233,6 +233,9 @@ inline bool MemoryManagerBase::Release(uint pid, uint page, uint top)
 					pri[0] = npid;
 					pages[page].inst = lsp[npid].inst;
 					pages[page].ptr  = lsp[npid].pages[page].ptr;
+#ifndef PTR_IDBIT
+					pages[page].func = lsp[npid].pages[page].func;
+#endif
 				}
 			}
 			ls.pages[page].ptr = 0;
@@ -8,7 +8,7 @@
 //	Sound Buffer
 //
 SoundBuffer2::SoundBuffer2()
-: source(0), buffer(0), buffersize(0)
+: source(0), ch(0)
 {
 	fillwhenempty = true;
 }
@@ -21,26 +21,22 @@ SoundBuffer2::~SoundBuffer2()
 bool SoundBuffer2::Init(SoundSource* _source, int _buffersize)
 {
 	CriticalSection::Lock lock(cs);
+	CriticalSection::Lock lockfill(csfill);
 	
-	delete[] buffer; buffer = 0;
+	ring.Cleanup();
 	
 	source = 0;
 	if (!_source)
 		return true;
 
-	buffersize = _buffersize;
-
 	ch = _source->GetChannels();
-	read = 0; write = 0;
 
-	if (!ch || buffersize <= 0)
+	if (!ch || _buffersize <= 0)
 		return false;
 	
-	buffer = new Sample[ch * buffersize];
-	if (!buffer)
+	if (!ring.Init(_buffersize, ch))
 		return false;
 
-	memset(buffer, 0, ch * buffersize * sizeof(Sample));
 	source = _source;
 	return true;
 }
@@ -48,8 +44,9 @@ bool SoundBuffer2::Init(SoundSource* _source, int _buffersize)
 void SoundBuffer2::Cleanup()
 {
 	CriticalSection::Lock lock(cs);
+	CriticalSection::Lock lockfill(csfill);
 	
-	delete[] buffer; buffer = 0;
+	ring.Cleanup();
 }
 
 // ---------------------------------------------------------------------------
@@ -57,7 +54,7 @@ void SoundBuffer2::Cleanup()
 //
 int SoundBuffer2::Fill(int samples)
 {
-	CriticalSection::Lock lock(cs);
+	CriticalSection::Lock lock(csfill);
 	if (source)
 		return FillMain(samples);
 	return 0;
@@ -66,36 +63,26 @@ int SoundBuffer2::Fill(int samples)
 int SoundBuffer2::FillMain(int samples)
 {
 	// リングバッファの空きを計算
-	int free = buffersize - GetAvail();
+	int free = ring.GetFree();
 
-	if (!fillwhenempty && (samples > free-1))
+	if (!fillwhenempty && (samples > free))
 	{
-		int skip = Min(samples-free+1, buffersize-free);
-		free += skip;
-		read += skip;
-		if (read > buffersize)
-			read -= buffersize;
+		// 古いデータは次の Get で捨ててもらう．今回書けるのは今空いている分だけ
+		ring.RequestDrop(Min(samples-free, ring.GetSize()-1-free));
 	}
 	
-	// 書きこむべきデータ量を計算
-	samples = Min(samples, free-1);
+	// 書きこむ
+	SPSCRing<Sample>::Segment seg[2];
+	samples = ring.BeginWrite(samples, seg);
 	if (samples > 0)
 	{
-		// 書きこむ
-		if (buffersize - write >= samples)
-		{
-			// 一度で書ける場合
-			source->Get(buffer + write * ch, samples);
-		}
-		else
+		source->Get(seg[0].ptr, seg[0].size);
+		if (seg[1].size)
 		{
 			// ２度に分けて書く場合
-			source->Get(buffer + write * ch, buffersize - write);
-			source->Get(buffer, samples - (buffersize - write));
+			source->Get(seg[1].ptr, seg[1].size);
 		}
-		write += samples;
-		if (write >= buffersize)
-			write -= buffersize;
+		ring.EndWrite(samples);
 	}
 	return samples;
 }
@@ -106,40 +93,29 @@ int SoundBuffer2::FillMain(int samples)
 int SoundBuffer2::Get(Sample* dest, int samples)
 {
 	CriticalSection::Lock lock(cs);
-	if (!buffer)
+	if (!ring.IsValid())
 		return 0;
 
-	for (int s=samples; s>0; )
-	{
-		int xsize = Min(s, buffersize - read);
-		
-		int avail = GetAvail();
+	// Fill が溢れた分を捨てる
+	ring.Drop();
 
+	int s = samples;
+	while (s > 0)
+	{
 		// 供給不足なら追加
-		if (xsize <= avail || fillwhenempty)
-		{
-			if (xsize > avail)
-				FillMain(xsize - avail);
-			memcpy(dest, buffer + read * ch, xsize * ch * sizeof(Sample));
-			dest += xsize * ch;
-			read += xsize;
-		}
-		else
+		if (fillwhenempty && ring.GetAvail() < s)
 		{
-			if (avail > 0)
-			{
-				memcpy(dest, buffer + read * ch, avail * ch * sizeof(Sample));
-				dest += avail * ch;
-				read += avail;
-			}
-			memset(dest, 0, (xsize - avail) * ch * sizeof(Sample));
-			dest += (xsize - avail) * ch;
+			CriticalSection::Lock lockfill(csfill);
+			FillMain(s - ring.GetAvail());
 		}
-		
-		s -= xsize;
-		if (read >= buffersize)
-			read -= buffersize;
+		int n = ring.Read(dest, s);
+		if (!n)
+			break;
+		dest += n * ch;
+		s -= n;
 	}
+	if (s > 0)
+		memset(dest, 0, s * ch * sizeof(Sample));
 	return samples;
 }
 
@@ -3,12 +3,16 @@
 #pragma once
 
 #include "critsect.h"
+#include "spscring.h"
 #include "if/ifcommon.h"
 #include "soundsrc.h"
 
 // ---------------------------------------------------------------------------
 //	SoundBuffer2
 //
+//	Fill する側と Get する側が 1 つずつのリングで，どちらも普段は
+//	ロックを取らない．Get が足りない分を自分で補充する時だけ Fill と排他する．
+//
 class SoundBuffer2 : public SoundSource
 {
 public:
@@ -31,13 +35,11 @@ public:
 private:
 	int		FillMain(int samples);
 
-	CriticalSection cs;
+	CriticalSection cs;					// Init/Cleanup と Get
+	CriticalSection csfill;				// バッファへの書き込み
 	
 	SoundSource* source;
-	Sample* buffer;
-	int buffersize;						// バッファのサイズ (in samples)
-	int read;							// 読込位置 (in samples)
-	int write;							// 書き込み位置 (in samples)
+	SPSCRing<Sample> ring;
 	int ch;								// チャネル数(1sample = ch*Sample)
 	bool fillwhenempty;
 };
@@ -61,11 +63,6 @@ inline int SoundBuffer2::GetChannels()
 
 inline int SoundBuffer2::GetAvail()
 {
-	int avail;
-	if (write >= read)
-		avail = write - read;
-	else
-		avail = buffersize + write - read;
-	return avail;
+	return ring.GetAvail();
 }
 
@@ -12,7 +12,7 @@
 //	Sound Buffer
 //
 SoundBuffer::SoundBuffer()
-: buffer(0), buffersize(0), ch(0)
+: ch(0)
 {
 	fillwhenempty = true;
 }
@@ -25,20 +25,15 @@ SoundBuffer::~SoundBuffer()
 bool SoundBuffer::Init(int nch, int bufsize)
 {
 	CriticalSection::Lock lock(cs);
+	CriticalSection::Lock lockput(csput);
 	
-	delete[] buffer; buffer = 0;
-	
-	buffersize = bufsize;
+	ring.Cleanup();
 	ch = nch;
-	read = 0; write = 0;
 
-	if (ch && buffersize > 0)
+	if (ch && bufsize > 0)
 	{
-		buffer = new Sample[ch * buffersize];
-		if (!buffer)
+		if (!ring.Init(bufsize, ch))
 			return false;
-
-		memset(buffer, 0, ch * buffersize * sizeof(Sample));
 	}
 	return true;
 }
@@ -46,8 +41,9 @@ bool SoundBuffer::Init(int nch, int bufsize)
 void SoundBuffer::Cleanup()
 {
 	CriticalSection::Lock lock(cs);
+	CriticalSection::Lock lockput(csput);
 	
-	delete[] buffer; buffer = 0;
+	ring.Cleanup();
 }
 
 // ---------------------------------------------------------------------------
@@ -55,47 +51,38 @@ void SoundBuffer::Cleanup()
 //
 void SoundBuffer::Put(int samples)
 {
-	CriticalSection::Lock lock(cs);
-	if (buffer)
+	CriticalSection::Lock lock(csput);
+	if (ring.IsValid())
 		PutMain(samples);
 }
 
 void SoundBuffer::PutMain(int samples)
 {
 	// リングバッファの空きを計算
-	int free;
-	if (read <= write)
-		free = buffersize + read - write;
-	else
-		free = read - write;
+	int free = ring.GetFree();
 
-	if (!fillwhenempty && (samples > free-1))
+	if (!fillwhenempty && (samples > free))
 	{
-		int skip = Min(samples-free+1, buffersize-free);
-		free += skip;
-		read += skip;
-		if (read > buffersize)
-			read -= buffersize;
+		// 古いデータは次の Get で捨ててもらう．今回書けるのは今空いている分だけ
+		ring.RequestDrop(Min(samples-free, ring.GetSize()-1-free));
 	}
 	
-	// 書きこむべきデータ量を計算
-	samples = Min(samples, free-1);
+	// 書きこむ
+	SPSCRing<Sample>::Segment seg[2];
+	samples = ring.BeginWrite(samples, seg);
 	if (samples > 0)
 	{
-		// 書きこむ
-		if (buffersize - write >= samples)
+		if (!seg[1].size)
 		{
 			// 一度で書ける場合
-			Mix(buffer + write * ch, samples);
+			Mix(seg[0].ptr, seg[0].size);
 		}
 		else
 		{
 			// ２度に分けて書く場合
-			Mix(buffer + write * ch, buffersize - write, buffer, samples - (buffersize - write));
+			Mix(seg[0].ptr, seg[0].size, seg[1].ptr, seg[1].size);
 		}
-		write += samples;
-		if (write >= buffersize)
-			write -= buffersize;
+		ring.EndWrite(samples);
 	}
 }
 
@@ -105,44 +92,28 @@ void SoundBuffer::PutMain(int samples)
 void SoundBuffer::Get(Sample* dest, int samples)
 {
 	CriticalSection::Lock lock(cs);
-	if (buffer)
+	if (!ring.IsValid())
+		return;
+
+	// Put が溢れた分を捨てる
+	ring.Drop();
+
+	while (samples > 0)
 	{
-		while (samples > 0)
+		// 供給不足なら追加
+		if (fillwhenempty && ring.GetAvail() < samples)
 		{
-			int xsize = Min(samples, buffersize - read);
-			
-			int avail;
-			if (write >= read)
-				avail = write - read;
-			else
-				avail = buffersize + write - read;
-
-			// 供給不足なら追加
-			if (xsize <= avail || fillwhenempty)
-			{
-				if (xsize > avail)
-					PutMain(xsize - avail);
-				memcpy(dest, buffer + read * ch, xsize * ch * sizeof(Sample));
-				dest += xsize * ch;
-				read += xsize;
-			}
-			else
-			{
-				if (avail > 0)
-				{
-					memcpy(dest, buffer + read * ch, avail * ch * sizeof(Sample));
-					dest += avail * ch;
-					read += avail;
-				}
-				memset(dest, 0, (xsize - avail) * ch * sizeof(Sample));
-				dest += (xsize - avail) * ch;
-			}
-			
-			samples -= xsize;
-			if (read >= buffersize)
-				read -= buffersize;
+			CriticalSection::Lock lockput(csput);
+			PutMain(samples - ring.GetAvail());
 		}
+		int n = ring.Read(dest, samples);
+		if (!n)
+			break;
+		dest += n * ch;
+		samples -= n;
 	}
+	if (samples > 0)
+		memset(dest, 0, samples * ch * sizeof(Sample));
 }
 
 // ---------------------------------------------------------------------------
@@ -150,12 +121,6 @@ void SoundBuffer::Get(Sample* dest, int samples)
 //
 bool SoundBuffer::IsEmpty()
 {
-	int avail;
-	if (write >= read)
-		avail = write - read;
-	else
-		avail = buffersize + write - read;
-	
-	return avail == 0;
+	return ring.GetAvail() == 0;
 }
 
@@ -8,11 +8,15 @@
 
 #include "types.h"
 #include "critsect.h"
+#include "spscring.h"
 #include "if/ifcommon.h"
 
 // ---------------------------------------------------------------------------
 //	SoundBuffer
 //
+//	Put する側と Get する側が 1 つずつのリングで，どちらも普段は
+//	ロックを取らない．Get が足りない分を自分で作る時だけ Put と排他する．
+//
 class SoundBuffer
 {
 public:
@@ -34,12 +38,10 @@ private:
 	virtual void Mix(Sample* b1, int s1, Sample* b2=0, int s2=0) = 0;	// sample 分のデータ生成
 	void PutMain(int sample);
 	
-	Sample* buffer;
-	CriticalSection cs;
+	SPSCRing<Sample> ring;
+	CriticalSection cs;					// Init/Cleanup と Get
+	CriticalSection csput;				// バッファへの書き込み
 	
-	int buffersize;						// バッファのサイズ (in samples)
-	int read;							// 読込位置 (in samples)
-	int write;							// 書き込み位置 (in samples)
 	int ch;								// チャネル数(1sample = ch*Sample)
 	bool fillwhenempty;
 };
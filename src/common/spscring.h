@@ -0,0 +1,293 @@
+// ---------------------------------------------------------------------------
+//	M88 - PC-8801 Emulator.
+// ---------------------------------------------------------------------------
+//	書き手・読み手が 1 つずつのリングバッファ
+// ---------------------------------------------------------------------------
+
+#pragma once
+
+#include "types.h"
+#include "misc.h"
+
+// ---------------------------------------------------------------------------
+//	SPSCRing
+//
+//	1 つのスレッドが書き，別の 1 つのスレッドが読むリングバッファ．
+//	書き込み位置は書き手だけ，読込位置は読み手だけが動かすので，
+//	どちらの操作もロックを取らず，相手を待つこともない．
+//
+//	要素は unit 個ずつのフレーム (ステレオなら 2 サンプル) で扱い，
+//	大きさ・位置・個数はすべてフレーム単位．満杯と空を区別するため
+//	1 フレームは常に空けておく．
+//
+//	書き手は内容を書いてから位置を進め，読み手は位置を見てから内容を
+//	読む．位置は volatile なので，VC の x86/x64 ではこの順序が保たれる．
+//	書き手と読み手の変数は別のキャッシュラインに置いて，互いの書き込みが
+//	相手の変数の載ったラインを追い出さないようにする．
+//	GetFree/GetAvail はどのスレッドから呼んでも良い．
+//
+//	mirror を指定すると，先頭 mirror フレームの複製を末尾にも持つ．
+//	読み手は Front() から mirror フレーム先まで折り返しを気にせずに
+//	連続して読める．
+//
+template <class T>
+class SPSCRing
+{
+public:
+	struct Segment
+	{
+		T* ptr;
+		int size;						// フレーム数
+	};
+
+public:
+	SPSCRing() : buffer(0), size(0), unit(0), mirror(0) { Reset(); }
+	~SPSCRing() { Cleanup(); }
+
+	bool Init(int size, int unit, int mirror = 0);
+	void Cleanup();
+	void Reset(int filled = 0);			// 両側が止まっている時だけ呼ぶ
+
+	bool IsValid() const { return buffer != 0; }
+	int GetSize() const { return size; }
+
+	// 書き手の操作
+	int GetFree();
+	int BeginWrite(int n, Segment* seg);
+	void EndWrite(int n);
+	int Write(const T* src, int n);
+	void RequestDrop(int n);
+
+	// 読み手の操作
+	int GetAvail();
+	int BeginRead(int n, Segment* seg);
+	void EndRead(int n);
+	int Read(T* dest, int n);
+	const T* Front() const { return buffer + rd.pos * unit; }
+	void Advance(int n);
+	int Drop();
+
+private:
+	enum { cacheline = 64 };
+
+	int Count(int w, int r) const { return w >= r ? w - r : size + w - r; }
+	int Split(int pos, int n, Segment* seg);
+	void Mirror(int from, int n);
+
+	// 両側から読むだけの値
+	T* buffer;
+	int size;
+	int unit;
+	int mirror;
+	char pad0[cacheline];
+
+	// 書き手の変数
+	struct Writer
+	{
+		volatile int pos;				// 書き込み位置
+		volatile uint dropreq;			// 捨てて欲しいフレーム数の累計
+	} wr;
+	char pad1[cacheline];
+
+	// 読み手の変数
+	struct Reader
+	{
+		volatile int pos;				// 読込位置
+		uint dropdone;					// 捨てたフレーム数の累計
+	} rd;
+	char pad2[cacheline];
+};
+
+// ---------------------------------------------------------------------------
+//	初期化
+//	size:	リングの大きさ (フレーム)．書けるのは size-1 フレームまで
+//	unit:	1 フレームの要素数
+//	mirror:	末尾に写す先頭のフレーム数
+//
+template <class T>
+bool SPSCRing<T>::Init(int _size, int _unit, int _mirror)
+{
+	Cleanup();
+	if (_size < 2 || _unit <= 0 || _mirror < 0 || _mirror > _size)
+		return false;
+
+	size = _size;
+	unit = _unit;
+	mirror = _mirror;
+	buffer = new T[(size + mirror) * unit];
+	if (!buffer)
+		return false;
+	memset(buffer, 0, (size + mirror) * unit * sizeof(T));
+	Reset();
+	return true;
+}
+
+template <class T>
+void SPSCRing<T>::Cleanup()
+{
+	delete[] buffer; buffer = 0;
+	size = 0;
+}
+
+// ---------------------------------------------------------------------------
+//	位置を初期化し，filled フレーム分の内容が入っている状態にする
+//
+template <class T>
+void SPSCRing<T>::Reset(int filled)
+{
+	filled = Min(filled, Max(size - 1, 0));
+	wr.pos = 0;
+	wr.dropreq = 0;
+	rd.pos = filled > 0 ? size - filled : 0;
+	rd.dropdone = 0;
+}
+
+// ---------------------------------------------------------------------------
+//	pos から n フレームを折り返しの前後 2 つの区間に分ける
+//
+template <class T>
+inline int SPSCRing<T>::Split(int pos, int n, Segment* seg)
+{
+	int l = Min(n, size - pos);
+	seg[0].ptr = buffer + pos * unit;
+	seg[0].size = l;
+	seg[1].ptr = buffer;
+	seg[1].size = n - l;
+	return n;
+}
+
+// ---------------------------------------------------------------------------
+//	書き込めるフレーム数
+//
+template <class T>
+inline int SPSCRing<T>::GetFree()
+{
+	return size - 1 - Count(wr.pos, rd.pos);
+}
+
+// ---------------------------------------------------------------------------
+//	最大 n フレームの書き込み先を seg[0], seg[1] に返す
+//	書ける分だけ書いたら EndWrite で公開する
+//
+template <class T>
+int SPSCRing<T>::BeginWrite(int n, Segment* seg)
+{
+	return Split(wr.pos, Max(Min(n, GetFree()), 0), seg);
+}
+
+template <class T>
+void SPSCRing<T>::EndWrite(int n)
+{
+	int w = wr.pos;
+	if (mirror && w < mirror)
+		Mirror(w, n);
+	if (w + n > size && mirror)
+		Mirror(0, w + n - size);
+	w += n;
+	if (w >= size)
+		w -= size;
+	wr.pos = w;							// 書き終えてから公開する
+}
+
+// ---------------------------------------------------------------------------
+//	先頭 mirror フレームの書き換えを末尾の複製に写す
+//
+template <class T>
+inline void SPSCRing<T>::Mirror(int from, int n)
+{
+	if (from < mirror)
+	{
+		n = Min(n, mirror - from);
+		memcpy(buffer + (size + from) * unit, buffer + from * unit, n * unit * sizeof(T));
+	}
+}
+
+// ---------------------------------------------------------------------------
+//	src から最大 n フレームを書き込む．書けたフレーム数を返す
+//
+template <class T>
+int SPSCRing<T>::Write(const T* src, int n)
+{
+	Segment seg[2];
+	n = BeginWrite(n, seg);
+	memcpy(seg[0].ptr, src, seg[0].size * unit * sizeof(T));
+	if (seg[1].size)
+		memcpy(seg[1].ptr, src + seg[0].size * unit, seg[1].size * unit * sizeof(T));
+	EndWrite(n);
+	return n;
+}
+
+// ---------------------------------------------------------------------------
+//	古い内容を n フレーム捨てるよう読み手に頼む
+//	読込位置は読み手だけが動かすので，実際に捨てるのは次の Drop
+//
+template <class T>
+inline void SPSCRing<T>::RequestDrop(int n)
+{
+	if (n > 0)
+		wr.dropreq = wr.dropreq + n;
+}
+
+// ---------------------------------------------------------------------------
+//	読めるフレーム数
+//
+template <class T>
+inline int SPSCRing<T>::GetAvail()
+{
+	return Count(wr.pos, rd.pos);
+}
+
+// ---------------------------------------------------------------------------
+//	最大 n フレームの読み出し元を seg[0], seg[1] に返す
+//	読み終えたら EndRead で位置を進める
+//
+template <class T>
+int SPSCRing<T>::BeginRead(int n, Segment* seg)
+{
+	return Split(rd.pos, Max(Min(n, GetAvail()), 0), seg);
+}
+
+template <class T>
+inline void SPSCRing<T>::EndRead(int n)
+{
+	Advance(n);
+}
+
+template <class T>
+inline void SPSCRing<T>::Advance(int n)
+{
+	int r = rd.pos + n;
+	if (r >= size)
+		r -= size;
+	rd.pos = r;							// 読み終えてから返す
+}
+
+// ---------------------------------------------------------------------------
+//	dest に最大 n フレームを読み出す．読めたフレーム数を返す
+//
+template <class T>
+int SPSCRing<T>::Read(T* dest, int n)
+{
+	Segment seg[2];
+	n = BeginRead(n, seg);
+	memcpy(dest, seg[0].ptr, seg[0].size * unit * sizeof(T));
+	if (seg[1].size)
+		memcpy(dest + seg[0].size * unit, seg[1].ptr, seg[1].size * unit * sizeof(T));
+	EndRead(n);
+	return n;
+}
+
+// ---------------------------------------------------------------------------
+//	書き手に頼まれた分を捨てる．捨てたフレーム数を返す
+//
+template <class T>
+int SPSCRing<T>::Drop()
+{
+	uint req = wr.dropreq;
+	if (req == rd.dropdone)
+		return 0;
+	int n = Min(int(req - rd.dropdone), GetAvail());
+	rd.dropdone = req;
+	Advance(n);
+	return n;
+}
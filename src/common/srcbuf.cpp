@@ -4,6 +4,10 @@
 #include "srcbuf.h"
 #include "misc.h"
 
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define SRC_USE_SSE2
+#include <emmintrin.h>
+#endif
 
 #ifndef PI
 #define PI			3.14159265358979323846
@@ -13,7 +17,7 @@
 //	Sound Buffer
 //
 SamplingRateConverter::SamplingRateConverter()
-: source(0), buffer(0), buffersize(0), h2(0), outputrate(0)
+: source(0), coef(0), outputrate(0)
 {
 	fillwhenempty = true;
 }
@@ -26,42 +30,42 @@ SamplingRateConverter::~SamplingRateConverter()
 bool SamplingRateConverter::Init(SoundSourceL* _source, int _buffersize, ulong outrate)
 {
 	CriticalSection::Lock lock(cs);
+	CriticalSection::Lock lockfill(csfill);
 	
-	delete[] buffer; buffer = 0;
+	ring.Cleanup();
 	
 	source = 0;
 	if (!_source)
 		return true;
 
-	buffersize = _buffersize;
-	assert(buffersize > (2 * M + 1));
+	assert(_buffersize > ntaps);
 
 	ch = _source->GetChannels();
-	read = 0; write = 0;
 
-	if (!ch || buffersize <= 0)
+	if (ch != 2 || _buffersize <= 0)
 		return false;
 	
-	buffer = new SampleL[ch * buffersize];
-	if (!buffer)
+	if (!ring.Init(_buffersize, ch, ntaps))
 		return false;
 
-	memset(buffer, 0, ch * buffersize * sizeof(SampleL));
 	source = _source;
 
 	outputrate = outrate;
 
 	MakeFilter(outrate);
-	read = 2 * M + 1;		// zero fill
+	if (!coef)
+		return false;
+	ring.Reset(_buffersize - (2 * M + 1));		// zero fill
 	return true;
 }
 
 void SamplingRateConverter::Cleanup()
 {
 	CriticalSection::Lock lock(cs);
+	CriticalSection::Lock lockfill(csfill);
 	
-	delete[] buffer; buffer = 0;
-	delete[] h2; h2 = 0;
+	ring.Cleanup();
+	delete[] coef; coef = 0;
 }
 
 // ---------------------------------------------------------------------------
@@ -69,7 +73,7 @@ void SamplingRateConverter::Cleanup()
 //
 int SamplingRateConverter::Fill(int samples)
 {
-	CriticalSection::Lock lock(cs);
+	CriticalSection::Lock lock(csfill);
 	if (source)
 		return FillMain(samples);
 	return 0;
@@ -78,42 +82,30 @@ int SamplingRateConverter::Fill(int samples)
 int SamplingRateConverter::FillMain(int samples)
 {
 	// リングバッファの空きを計算
-	int free = buffersize - Avail();
+	int free = ring.GetFree();
 	
-	if (!fillwhenempty && (samples > free-1))
+	if (!fillwhenempty && (samples > free))
 	{
-		int skip = Min(samples-free+1, buffersize-free);
-		free += skip;
-		read += skip;
-		if (read > buffersize)
-			read -= buffersize;
+		// 古いデータは次の Get で捨ててもらう．今回書けるのは今空いている分だけ
+		ring.RequestDrop(Min(samples-free, ring.GetSize()-1-free));
 	}
 	
-	// 書きこむべきデータ量を計算
-	samples = Min(samples, free-1);
+	// 書きこむ．先頭 ntaps サンプルの末尾への複製は ring が作る
+	SPSCRing<SampleL>::Segment seg[2];
+	samples = ring.BeginWrite(samples, seg);
 	if (samples > 0)
 	{
-		// 書きこむ
-		if (buffersize - write >= samples)
-		{
-			// 一度で書ける場合
-			source->Get(buffer + write * ch, samples);
-		}
-		else
+		source->Get(seg[0].ptr, seg[0].size);
+		if (seg[1].size)
 		{
 			// ２度に分けて書く場合
-			source->Get(buffer + write * ch, buffersize - write);
-			source->Get(buffer, samples - (buffersize - write));
+			source->Get(seg[1].ptr, seg[1].size);
 		}
-		write += samples;
-		if (write >= buffersize)
-			write -= buffersize;
+		ring.EndWrite(samples);
 	}
 	return samples;
 }
 
-
-
 // ---------------------------------------------------------------------------
 //	フィルタを構築
 //
@@ -151,8 +143,7 @@ void SamplingRateConverter::MakeFilter(ulong out)
 	// FIR LPF (窓関数はカイザー窓)
 	n = (M+1) * ic;						// n = フィルタの次数
 	
-	delete[] h2;
-	h2 = new float[(ic+1)*(M+1)];
+	float* h2 = new float[(ic+1)*(M+1)];
 	
 	double gain = 2 * ic * fc / r;
 	double a = 10.;					// a = 阻止域での減衰量を決める
@@ -181,61 +172,93 @@ void SamplingRateConverter::MakeFilter(ulong out)
 			ii += ic;
 		}
 	}
+
+	// 位相 oo の出力に掛ける係数を，入力の並び (read から 2*M+1 サンプル) の
+	// 順に並べ直す．左右で同じ係数を使うので 2 つずつ並べる
+	delete[] coef;
+	coef = new float[ic * ntaps * 2];
+	for (int o=0; o<ic; o++)
+	{
+		float* dst = coef + o * ntaps * 2;
+		int k = 0;
+		const float* h = &h2[(ic-o) * (M+1) + M];
+		for (int i=-M; i<=0; i++, k++)
+			dst[k*2] = dst[k*2+1] = *h--;
+		h = &h2[o * (M+1)];
+		for (int i=1; i<=M; i++, k++)
+			dst[k*2] = dst[k*2+1] = *h++;
+		for (; k<ntaps; k++)
+			dst[k*2] = dst[k*2+1] = 0.f;
+	}
+	delete[] h2;
 	oo=0;
 }
 
+// ---------------------------------------------------------------------------
+//	1 サンプル分のフィルタ
+//	src から ntaps サンプル (ステレオ) に h を掛けて足し合わせる
+//
+inline void SamplingRateConverter::Convolve(Sample* dest, const SampleL* src, const float* h)
+{
+#ifdef SRC_USE_SSE2
+	// 1 つのベクタに 2 サンプル分の左右を入れて計算する
+	__m128 a0 = _mm_setzero_ps();
+	__m128 a1 = _mm_setzero_ps();
+	__m128 a2 = _mm_setzero_ps();
+	__m128 a3 = _mm_setzero_ps();
+	for (int k=0; k<ntaps*2; k+=16)
+	{
+		const __m128i* s = (const __m128i*) (src + k);
+		a0 = _mm_add_ps(a0, _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128(s + 0)), _mm_loadu_ps(h + k + 0)));
+		a1 = _mm_add_ps(a1, _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128(s + 1)), _mm_loadu_ps(h + k + 4)));
+		a2 = _mm_add_ps(a2, _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128(s + 2)), _mm_loadu_ps(h + k + 8)));
+		a3 = _mm_add_ps(a3, _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128(s + 3)), _mm_loadu_ps(h + k + 12)));
+	}
+	__m128 a = _mm_add_ps(_mm_add_ps(a0, a1), _mm_add_ps(a2, a3));
+	a = _mm_add_ps(a, _mm_movehl_ps(a, a));		// L, R
+	__m128i z = _mm_cvttps_epi32(a);
+	z = _mm_packs_epi32(z, z);					// 飽和させて 16bit に
+	*(int32*) dest = _mm_cvtsi128_si32(z);
+#else
+	float z0=0.f, z1=0.f;
+	for (int k=0; k<ntaps*2; k+=2)
+	{
+		z0 += h[k] * src[k];
+		z1 += h[k+1] * src[k+1];
+	}
+	dest[0] = Limit(z0, 32767, -32768);
+	dest[1] = Limit(z1, 32767, -32768);
+#endif
+}
+
 // ---------------------------------------------------------------------------
 //	バッファから音を貰う
 //
 int SamplingRateConverter::Get(Sample* dest, int samples)
 {
 	CriticalSection::Lock lock(cs);
-	if (!buffer)
+	if (!ring.IsValid())
 		return 0;
 
+	// Fill が溢れた分を捨てる
+	ring.Drop();
+
 	int count;
 	int ss = samples;
 	for (count=samples; count>0; count--)
 	{
-		int p = read;
-
-		int i;
-		float* h;
-
-		float z0=0.f, z1=0.f;
-
-		h = &h2[(ic-oo) * (M+1) + (M)];
-		for (i=-M; i<=0; i++)
-		{
-			z0 += *h * buffer[p*2];
-			z1 += *h * buffer[p*2+1];
-			h--;
-			p++;
-			if (p == buffersize)
-				p = 0;
-		}
-
-		h = &h2[oo * (M+1)];
-		for (; i<=M; i++)
-		{
-			z0 += *h * buffer[p*2];
-			z1 += *h * buffer[p*2+1];
-			h++;
-			p++;
-			if (p == buffersize)
-				p = 0;
-		}
-		*dest++ = Limit(z0, 32767, -32768);
-		*dest++ = Limit(z1, 32767, -32768);
+		Convolve(dest, ring.Front(), coef + oo * ntaps * 2);
+		dest += 2;
 
 		oo -= oc;
 		while (oo < 0)
 		{
-			read++;
-			if (read == buffersize)
-				read = 0;
-			if (Avail() < 2*M+1)
+			ring.Advance(1);
+			if (ring.GetAvail() < 2*M+1)
+			{
+				CriticalSection::Lock lockfill(csfill);
 				FillMain(Max(ss, count));
+			}
 			ss = 0;
 			oo += ic;
 		}
@@ -3,6 +3,7 @@
 #pragma once
 
 #include "critsect.h"
+#include "spscring.h"
 #include "soundsrc.h"
 
 
@@ -10,6 +11,12 @@
 // ---------------------------------------------------------------------------
 //	SamplingRateConverter
 //
+//	バッファは書き手 (Fill) と読み手 (Get) が 1 つずつのリング (SPSCRing) で，
+//	普段の Fill と Get はロックを取らないので，再生スレッドの変換が
+//	VM のスレッドを止めない．
+//	Get がバッファを使い切って自分で補充する時だけ，書き込み側の
+//	ロック (csfill) を取る．
+//
 class SamplingRateConverter : public SoundSource
 {
 public:
@@ -34,19 +41,17 @@ private:
 		osmax = 500,
 		osmin = 100,
 		M = 30,		// M
+		ntaps = 64,	// 1 出力あたりのタップ数 (2*M+1 を切り上げ，余りは係数 0)
 	};
 
 	int		FillMain(int samples);
+	static void Convolve(Sample* dest, const SampleL* src, const float* h);
 	void	MakeFilter(ulong outrate);
-	int		Avail();
 	
 	SoundSourceL* source;
-	SampleL* buffer;
-	float* h2;
+	SPSCRing<SampleL> ring;				// 末尾に先頭 ntaps サンプルの複製を持つ
+	float* coef;						// 位相ごとのフィルタ係数 (ntaps * 2ch)
 
-	int buffersize;						// バッファのサイズ (in samples)
-	int read;							// 読込位置 (in samples)
-	int write;							// 書き込み位置 (in samples)
 	int ch;								// チャネル数(1sample = ch*Sample)
 	bool fillwhenempty;
 
@@ -58,7 +63,8 @@ private:
 
 	int outputrate;
 
-	CriticalSection cs;
+	CriticalSection cs;					// Init/Cleanup と Get
+	CriticalSection csfill;				// バッファへの書き込み
 };
 
 // ---------------------------------------------------------------------------
@@ -81,18 +87,9 @@ inline int SamplingRateConverter::GetChannels()
 // ---------------------------------------------------------------------------
 //	バッファが空か，空に近い状態か?
 //
-inline int SamplingRateConverter::Avail()
-{
-	if (write >= read)
-		return write - read;
-	else
-		return buffersize + write - read;
-}
-
 inline int SamplingRateConverter::GetAvail()
 {
-	CriticalSection::Lock lock(cs);
-	return Avail();
+	return ring.GetAvail();
 }
 
 inline bool SamplingRateConverter::IsEmpty()
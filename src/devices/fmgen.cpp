@@ -26,6 +26,11 @@
 #include "fmgen.h"
 #include "fmgeninl.h"
 
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define FM_USE_SSE2
+#include <emmintrin.h>
+#endif
+
 #define LOGNAME "fmgen"
 
 // ---------------------------------------------------------------------------
@@ -149,8 +154,6 @@ namespace FM
 	// fixed equasion-based tables
 	int		pmtable[2][8][FM_LFOENTS];
 	uint	amtable[2][4][FM_LFOENTS];
-
-	static bool tablemade = false;
 }
 
 namespace FM
@@ -158,14 +161,10 @@ namespace FM
 
 // ---------------------------------------------------------------------------
 //	テーブル作成
+//	Operator::BuildTable から一度だけ呼ばれる
 //
 void MakeLFOTable()
 {
-	if (tablemade)
-		return;
-
-	tablemade = true;
-	
 	int i;
 
 	static const double pms[2][8] = 
@@ -254,7 +253,6 @@ void Chip::MakeTable()
 // ---------------------------------------------------------------------------
 //	Operator
 //
-bool FM::Operator::tablehasmade = false;
 uint FM::Operator::sinetable[1024];
 int32 FM::Operator::cltable[FM_CLENTS];
 
@@ -262,8 +260,7 @@ int32 FM::Operator::cltable[FM_CLENTS];
 FM::Operator::Operator()
 : chip_(0)
 {
-	if (!tablehasmade)
-		MakeTable();
+	MakeTable();
 
 	// EG Part
 	ar_ = dr_ = sr_ = rr_ = key_scale_rate_ = 0;
@@ -304,7 +301,18 @@ void FM::Operator::Reset()
 	PARAMCHANGE(0);
 }
 
+// ---------------------------------------------------------------------------
+//	テーブル作成
+//	テーブルは全インスタンスで共有する．関数内 static の初期化は一度だけ
+//	排他的に行われるので，複数のスレッドで同時に構築しても安全
+//
 void Operator::MakeTable()
+{
+	static const bool made = BuildTable();
+	(void) made;
+}
+
+bool Operator::BuildTable()
 {
 	// 対数テーブルの作成
 	assert(FM_CLENTS >= 256);
@@ -340,8 +348,7 @@ void Operator::MakeTable()
 	}
 
 	::FM::MakeLFOTable();
-
-	tablehasmade = true;
+	return true;
 }
 
 
@@ -705,6 +712,87 @@ inline FM::ISample FM::Operator::CalcFBL(uint fb)
 	return out_;
 }
 
+// ---------------------------------------------------------------------------
+//	ブロック合成
+//	Channel4::CalcBlock から呼ばれ，n サンプル分の EG/PG をまとめて進める．
+//	結果は 1 サンプルずつ Calc した場合と完全に一致する
+//
+//	EG を n サンプル進め，各サンプルで使う eg_out_ を level に書く
+//	eg_count_ が 0 以下になるまで eg_out_ は変わらないので，
+//	次に EGCalc が起きるサンプルまではまとめて埋める
+void FM::Operator::EGBlock(uint* level, int n)
+{
+	int i = 0;
+	while (i < n)
+	{
+		// 次に EGCalc が起きるのは何サンプル目か (そのサンプルを含む)
+		int s;
+		if (eg_count_ <= 0)
+			s = 1;
+		else if (eg_count_diff_ > 0)
+			s = (eg_count_ - 1) / eg_count_diff_ + 1;
+		else
+			s = n - i + 1;
+
+		uint out = eg_out_;
+		if (s > n - i)
+		{
+			eg_count_ -= (n - i) * eg_count_diff_;
+			for (; i<n; i++)
+				level[i] = out;
+			break;
+		}
+		eg_count_ -= s * eg_count_diff_;
+		for (int e=i+s-1; i<e; i++)
+			level[i] = out;
+		EGCalc();
+		level[i++] = eg_out_;
+	}
+}
+
+//	PG を n サンプル進め，各サンプルの位相 (サインテーブルの位置) を pg に書く
+void FM::Operator::PGBlock(int* pg, int n)
+{
+	uint32 c = pg_count_;
+	uint32 d = pg_diff_;
+	int i = 0;
+#ifdef FM_USE_SSE2
+	//	LFO が掛かっていなければ位相は等差数列なので 4 サンプルずつ求める
+	__m128i v = _mm_setr_epi32(c, c + d, c + d * 2, c + d * 3);
+	__m128i step = _mm_set1_epi32(d * 4);
+	for (; i+4<=n; i+=4)
+	{
+		_mm_storeu_si128((__m128i*) &pg[i], _mm_srli_epi32(v, 20+FM_PGBITS-FM_OPSINBITS));
+		v = _mm_add_epi32(v, step);
+	}
+	c += d * i;
+#endif
+	for (; i<n; i++)
+	{
+		pg[i] = c >> (20+FM_PGBITS-FM_OPSINBITS);
+		c += d;
+	}
+	dbgpgout_ = c - d;
+	pg_count_ = c;
+}
+
+//	PG (LFO あり)  pmv はサンプルごとの Chip::GetPMV() の値
+void FM::Operator::PGBlockL(int* pg, int n, const int* pmv)
+{
+	uint32 c = pg_count_;
+	uint32 d = pg_diff_;
+	int32 dl = pg_diff_lfo_;
+	uint32 last = c;
+	for (int i=0; i<n; i++)
+	{
+		last = c;
+		pg[i] = c >> (20+FM_PGBITS-FM_OPSINBITS);
+		c += d + ((dl * pmv[i]) >> 5);
+	}
+	dbgpgout_ = last;
+	pg_count_ = c;
+}
+
 #undef Sine
 
 // ---------------------------------------------------------------------------
@@ -713,25 +801,29 @@ inline FM::ISample FM::Operator::CalcFBL(uint fb)
 const uint8 Channel4::fbtable[8] = { 31, 7, 6, 5, 4, 3, 2, 1 };
 int Channel4::kftable[64];
 
-bool Channel4::tablehasmade = false;
-
-
 Channel4::Channel4()
 {
-	if (!tablehasmade)
-		MakeTable();
+	MakeTable();
 
 	SetAlgorithm(0);
 	pms = pmtable[0][0];
 }
 
+//	kftable の作成 (Operator::MakeTable と同じく一度だけ)
 void Channel4::MakeTable()
+{
+	static const bool made = BuildTable();
+	(void) made;
+}
+
+bool Channel4::BuildTable()
 {
 	// 100/64 cent =  2^(i*100/64*1200)
 	for (int i=0; i<64; i++)
 	{
 		kftable[i] = int(0x10000 * pow(2., i / 768.) );
 	}
+	return true;
 }
 
 // リセット
@@ -986,4 +1078,196 @@ ISample Channel4::CalcLN(uint noise)
 	return *out[2] + o;
 }
 
+// ---------------------------------------------------------------------------
+//	ブロック合成
+//	Calc/CalcL を n 回呼ぶのと同じ結果を，次の 3 段階で求める．
+//
+//	BeginBlock	EG/PG をオペレータごとに n サンプル分進めておく
+//	CalcBlockFB	op[0] (セルフフィードバック) の出力を求める．
+//				前のサンプルの自分の出力に依存するので 1 サンプルずつしか
+//				計算できないが，複数のチャンネルを交互に計算して待ちを埋める
+//	EndBlock	op[1]-op[3] の出力を求める．
+//				Calc は op[2], op[1], op[3], op[0] の順に計算するので，
+//				各オペレータの入力は op[0] の出力と，同じサンプルまたは
+//				1 つ前のサンプルの他のオペレータの出力だけで決まる．
+//				そのためオペレータごとにまとめて (サンプル間の依存なしに) 計算できる
+//
+void Channel4::BeginBlock(int n)
+{
+	for (int j=0; j<4; j++)
+	{
+		op[j].EGBlock(block.lv[j], n);
+		op[j].PGBlock(block.pg[j], n);
+	}
+	block.o0[0] = op[0].out2_;
+	block.o0[1] = op[0].out_;
+	block.lfo = false;
+}
+
+//	LFO あり  aml/pml はサンプルごとの Chip::GetAML()/GetPML() の値
+void Channel4::BeginBlockL(int n, const uint8* aml, const uint8* pml)
+{
+	int pmv[FM_BLOCKSIZE];
+	int i;
+	for (i=0; i<n; i++)
+		pmv[i] = pms[pml[i]];
+	chip_->SetPMV(pmv[n-1]);
+
+	for (int j=0; j<4; j++)
+	{
+		op[j].EGBlock(block.lv[j], n);
+		op[j].PGBlockL(block.pg[j], n, pmv);
+		const uint* ams = op[j].ams_;
+		for (i=0; i<n; i++)
+			block.lv[j][i] += ams[aml[i]];
+	}
+	block.o0[0] = op[0].out2_;
+	block.o0[1] = op[0].out_;
+	block.lfo = true;
+}
+
+//	op[0] の計算 (Operator::CalcFB/CalcFBL)
+void Channel4::CalcBlockFB(Channel4* const* ch, int nch, int n)
+{
+	assert(nch <= 8);
+	ISample* o[8];
+	const int* pg[8];
+	const uint* lv[8];
+	uint fbs[8];
+	int k;
+	for (k=0; k<nch; k++)
+	{
+		o[k] = ch[k]->block.o0 + 2;
+		pg[k] = ch[k]->block.pg[0];
+		lv[k] = ch[k]->block.lv[0];
+		fbs[k] = ch[k]->fb;
+	}
+	for (int i=0; i<n; i++)
+	{
+		for (k=0; k<nch; k++)
+		{
+			ISample in = o[k][i-1] + o[k][i-2];
+			int pgin = pg[k][i];
+			if (fbs[k] < 31)
+				pgin += ((in << (1 + IS2EC_SHIFT)) >> fbs[k]) >> (20+FM_PGBITS-FM_OPSINBITS);
+			uint a = lv[k][i] + Operator::sinetable[pgin & (FM_OPSINENTS-1)];
+			o[k][i] = Operator::cltable[a < FM_CLENTS ? a : FM_CLENTS-1];
+		}
+	}
+}
+
+//	1 オペレータ分の計算 (Operator::Calc の EG/PG 以外の部分)
+//	入力は in1[i] + in2[i]
+//	cltable の最後の要素は 0 なので，範囲外の時はそれを読んで分岐を避ける
+inline void Channel4::BlockOp(ISample* dest, const int* pg, const uint* lv,
+							  const ISample* in1, const ISample* in2, int n)
+{
+	for (int i=0; i<n; i++)
+	{
+		ISample in = in1[i] + in2[i];
+		uint a = lv[i] + Operator::sinetable[(pg[i]
+				 + (in >> (20+FM_PGBITS-FM_OPSINBITS-(2+IS2EC_SHIFT)))) & (FM_OPSINENTS-1)];
+		dest[i] = Operator::cltable[a < FM_CLENTS ? a : FM_CLENTS-1];
+	}
+}
+
+//	op[1]-op[3] の計算と出力
+void Channel4::EndBlock(ISample* dest, int n)
+{
+	static const ISample zero[FM_BLOCKSIZE] = { 0, };
+	ISample o1buf[FM_BLOCKSIZE+1];
+	ISample o2[FM_BLOCKSIZE];
+	ISample* o3 = dest;
+	const ISample* o0 = block.o0 + 2;	// 今回の出力
+	const ISample* o0p = block.o0 + 1;	// 1 つ前のサンプルの出力
+	ISample* o1 = o1buf + 1;
+	const ISample* o1p = o1buf;
+	o1buf[0] = op[1].out_;
+
+	const int (*pg)[FM_BLOCKSIZE] = block.pg;
+	const uint (*lv)[FM_BLOCKSIZE] = block.lv;
+	int i;
+	switch (algo_)
+	{
+	case 0:
+		BlockOp(o1, pg[1], lv[1], o0p, zero, n);
+		BlockOp(o2, pg[2], lv[2], o1p, zero, n);
+		BlockOp(o3, pg[3], lv[3], o2, zero, n);
+		break;
+	case 1:
+		BlockOp(o1, pg[1], lv[1], zero, zero, n);
+		BlockOp(o2, pg[2], lv[2], o0p, o1p, n);
+		BlockOp(o3, pg[3], lv[3], o2, zero, n);
+		break;
+	case 2:
+		BlockOp(o1, pg[1], lv[1], zero, zero, n);
+		BlockOp(o2, pg[2], lv[2], o1p, zero, n);
+		BlockOp(o3, pg[3], lv[3], o0p, o2, n);
+		break;
+	case 3:
+		BlockOp(o1, pg[1], lv[1], o0p, zero, n);
+		BlockOp(o2, pg[2], lv[2], zero, zero, n);
+		BlockOp(o3, pg[3], lv[3], o1, o2, n);
+		break;
+	case 4:
+		BlockOp(o1, pg[1], lv[1], o0p, zero, n);
+		BlockOp(o2, pg[2], lv[2], zero, zero, n);
+		BlockOp(o3, pg[3], lv[3], o2, zero, n);
+		for (i=0; i<n; i++)
+			dest[i] += o1[i];
+		break;
+	case 5:
+		BlockOp(o1, pg[1], lv[1], o0p, zero, n);
+		BlockOp(o2, pg[2], lv[2], o0p, zero, n);
+		BlockOp(o3, pg[3], lv[3], o0p, zero, n);
+		for (i=0; i<n; i++)
+			dest[i] += o1[i] + o2[i];
+		break;
+	case 6:
+		BlockOp(o1, pg[1], lv[1], o0p, zero, n);
+		BlockOp(o2, pg[2], lv[2], zero, zero, n);
+		BlockOp(o3, pg[3], lv[3], zero, zero, n);
+		for (i=0; i<n; i++)
+			dest[i] += o1[i] + o2[i];
+		break;
+	case 7:
+		BlockOp(o1, pg[1], lv[1], zero, zero, n);
+		BlockOp(o2, pg[2], lv[2], zero, zero, n);
+		BlockOp(o3, pg[3], lv[3], zero, zero, n);
+		//	CalcFB は前回の，CalcFBL は今回の出力を返す
+		{
+			const ISample* f = block.lfo ? o0 : o0p;
+			for (i=0; i<n; i++)
+				dest[i] += o1[i] + o2[i] + f[i];
+		}
+		break;
+	}
+
+	op[0].out_ = o0[n-1], op[0].out2_ = o0[n-2];
+	op[1].out_ = o1[n-1];
+	op[2].out_ = o2[n-1];
+	op[3].out_ = o3[n-1];
+	op[0].dbgopout_ = block.lfo ? o0[n-1] : o0[n-2];
+	op[1].dbgopout_ = o1[n-1];
+	op[2].dbgopout_ = o2[n-1];
+	op[3].dbgopout_ = o3[n-1];
+}
+
+//	1 チャンネルだけのブロック合成
+void Channel4::CalcBlock(ISample* dest, int n)
+{
+	Channel4* self = this;
+	BeginBlock(n);
+	CalcBlockFB(&self, 1, n);
+	EndBlock(dest, n);
+}
+
+void Channel4::CalcBlockL(ISample* dest, int n, const uint8* aml, const uint8* pml)
+{
+	Channel4* self = this;
+	BeginBlockL(n, aml, pml);
+	CalcBlockFB(&self, 1, n);
+	EndBlock(dest, n);
+}
+
 }	// namespace FM
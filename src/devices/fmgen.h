@@ -30,6 +30,9 @@
 //	サイン波の精度は 2^(1/256)
 #define FM_CLENTS		(0x1000 * 2)	// sin + TL + LFO
 
+//	ブロック合成で一度に処理する最大サンプル数
+#define FM_BLOCKSIZE	64
+
 // ---------------------------------------------------------------------------
 
 namespace FM
@@ -124,6 +127,11 @@ namespace FM
 		int		FBCalc(int fb);
 		ISample LogToLin(uint a);
 
+	//	Block ----------------------------------------------------------------
+		void	EGBlock(uint* level, int n);
+		void	PGBlock(int* pg, int n);
+		void	PGBlockL(int* pg, int n, const int* pmv);
+
 		
 		OpType	type_;		// OP の種類 (M, N...)
 		uint	bn_;		// Block/Note
@@ -175,8 +183,8 @@ namespace FM
 		static uint	sinetable[1024];
 		static int32 cltable[FM_CLENTS];
 
-		static bool tablehasmade;
 		static void MakeTable();
+		static bool BuildTable();
 
 
 
@@ -202,6 +210,12 @@ namespace FM
 		ISample CalcL();
 		ISample CalcN(uint noise);
 		ISample CalcLN(uint noise);
+		void CalcBlock(ISample* dest, int n);
+		void CalcBlockL(ISample* dest, int n, const uint8* aml, const uint8* pml);
+		void BeginBlock(int n);
+		void BeginBlockL(int n, const uint8* aml, const uint8* pml);
+		void EndBlock(ISample* dest, int n);
+		static void CalcBlockFB(Channel4* const* ch, int nch, int n);
 		void SetFNum(uint fnum);
 		void SetFB(uint fb);
 		void SetKCKF(uint kc, uint kf);
@@ -227,9 +241,22 @@ namespace FM
 		int		algo_;
 		Chip*	chip_;
 
+		//	ブロック合成の作業領域
+		struct Block
+		{
+			int		pg[4][FM_BLOCKSIZE];	// 各サンプルの位相
+			uint	lv[4][FM_BLOCKSIZE];	// 各サンプルの EG (+AM) 出力
+			ISample	o0[FM_BLOCKSIZE+2];		// op[0] の出力 ([0], [1] は前のブロックの分)
+			bool	lfo;
+		};
+		Block	block;
+
+		static void BlockOp(ISample* dest, const int* pg, const uint* lv,
+							const ISample* in1, const ISample* in2, int n);
+
 		static void MakeTable();
+		static bool BuildTable();
 
-		static bool tablehasmade;
 		static int 	kftable[64];
 
 
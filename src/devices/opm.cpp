@@ -14,7 +14,7 @@
 namespace FM
 {
 
-int OPM::amtable[4][OPM_LFOENTS] = { -1, };
+int OPM::amtable[4][OPM_LFOENTS];
 int OPM::pmtable[4][OPM_LFOENTS];
 
 // ---------------------------------------------------------------------------
@@ -315,13 +315,18 @@ void OPM::SetParameter(uint addr, uint data)
 }
 
 // ---------------------------------------------------------------------------
-//
+//	LFO テーブル
+//	ノイズ波形に rand() を使うので実行時に作る．全インスタンスで共有するので
+//	関数内 static の初期化で一度だけ作る
 //
 void OPM::BuildLFOTable()
 {
-	if (amtable[0][0] != -1)
-		return;
+	static const bool made = MakeLFOTable();
+	(void) made;
+}
 
+bool OPM::MakeLFOTable()
+{
 	for (int type=0; type<4; type++)
 	{
 		int r = 0;
@@ -360,6 +365,7 @@ void OPM::BuildLFOTable()
 //			printf("%d ", p);
 		}
 	}
+	return true;
 }
 
 // ---------------------------------------------------------------------------
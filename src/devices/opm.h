@@ -148,6 +148,7 @@ namespace FM
 		Chip	chip;
 
 		static void	BuildLFOTable();
+		static bool	MakeLFOTable();
 		static int amtable[4][OPM_LFOENTS];
 		static int pmtable[4][OPM_LFOENTS];
 
@@ -377,11 +377,19 @@ void OPN::Mix(Sample* buffer, int nsamples)
 
 #if defined(BUILD_OPNA) || defined(BUILD_OPNB)
 
-int OPNABase::amtable[FM_LFOENTS] = { -1, };
-int OPNABase::pmtable[FM_LFOENTS];
+//	LFO の波形は定数から決まるのでコンパイル時に展開する
+#define LFO4(f, c)		f(c), f(c+1), f(c+2), f(c+3)
+#define LFO16(f, c)		LFO4(f, c), LFO4(f, c+4), LFO4(f, c+8), LFO4(f, c+12)
+#define LFO64(f, c)		LFO16(f, c), LFO16(f, c+16), LFO16(f, c+32), LFO16(f, c+48)
+#define LFO256(f)		LFO64(f, 0), LFO64(f, 0x40), LFO64(f, 0x80), LFO64(f, 0xc0)
+
+#define LFOPM(c)		((c) < 0x40 ? (c) * 2 + 0x80 : (c) < 0xc0 ? 0x7f - ((c) - 0x40) * 2 + 0x80 : ((c) - 0xc0) * 2)
+#define LFOAM(c)		(((c) < 0x80 ? 0xff - (c) * 2 : ((c) - 0x80) * 2) & ~3)
+
+const int OPNABase::amtable[FM_LFOENTS] = { LFO256(LFOAM) };
+const int OPNABase::pmtable[FM_LFOENTS] = { LFO256(LFOPM) };
 
 int32 OPNABase::tltable[FM_TLENTS+FM_TLPOS];
-bool OPNABase::tablehasmade = false;
 
 OPNABase::OPNABase()
 {
@@ -394,7 +402,6 @@ OPNABase::OPNABase()
 	control2 = 0;
 
 	MakeTable2();
-	BuildLFOTable();
 	for (int i=0; i<6; i++)
 	{
 		ch[i].SetChip(&chip);
@@ -423,18 +430,22 @@ bool OPNABase::Init(uint c, uint r, bool)
 
 // ---------------------------------------------------------------------------
 //	テーブル作成
+//	tltable は全インスタンスで共有するので，最初の一度だけ作る
+//	(関数内 static の初期化はスレッド間でも一度しか行われない)
 //
 void OPNABase::MakeTable2()
 {
-	if (!tablehasmade)
-	{
-		for (int i=-FM_TLPOS; i<FM_TLENTS; i++)
-		{
-			tltable[i+FM_TLPOS] = uint(65536. * pow(2.0, i * -16. / FM_TLENTS))-1;
-		}
+	static const bool made = BuildTLTable();
+	(void) made;
+}
 
-		tablehasmade = true;
+bool OPNABase::BuildTLTable()
+{
+	for (int i=-FM_TLPOS; i<FM_TLENTS; i++)
+	{
+		tltable[i+FM_TLPOS] = uint(65536. * pow(2.0, i * -16. / FM_TLENTS))-1;
 	}
+	return true;
 }
 
 // ---------------------------------------------------------------------------
@@ -1093,49 +1104,6 @@ void OPNABase::FMMix(Sample* buffer, int nsamples)
 
 // ---------------------------------------------------------------------------
 
-void OPNABase::MixSubSL(int activech, ISample** dest)
-{
-	if (activech & 0x001) (*dest[0]  = ch[0].CalcL());
-	if (activech & 0x004) (*dest[1] += ch[1].CalcL());
-	if (activech & 0x010) (*dest[2] += ch[2].CalcL());
-	if (activech & 0x040) (*dest[3] += ch[3].CalcL());
-	if (activech & 0x100) (*dest[4] += ch[4].CalcL());
-	if (activech & 0x400) (*dest[5] += ch[5].CalcL());
-}
-
-inline void OPNABase::MixSubS(int activech, ISample** dest)
-{
-	if (activech & 0x001) (*dest[0]  = ch[0].Calc());
-	if (activech & 0x004) (*dest[1] += ch[1].Calc());
-	if (activech & 0x010) (*dest[2] += ch[2].Calc());
-	if (activech & 0x040) (*dest[3] += ch[3].Calc());
-	if (activech & 0x100) (*dest[4] += ch[4].Calc());
-	if (activech & 0x400) (*dest[5] += ch[5].Calc());
-}
-
-// ---------------------------------------------------------------------------
-
-void OPNABase::BuildLFOTable()
-{
-	if (amtable[0] == -1)
-	{
-		for (int c=0; c<256; c++)
-		{
-			int v;
-			if (c < 0x40)		v = c * 2 + 0x80;
-			else if (c < 0xc0)	v = 0x7f - (c - 0x40) * 2 + 0x80;
-			else				v = (c - 0xc0) * 2;
-			pmtable[c] = v;
-
-			if (c < 0x80)		v = 0xff - c * 2;
-			else				v = (c - 0x80) * 2;
-			amtable[c] = v & ~3;
-		}
-	}
-}
-
-// ---------------------------------------------------------------------------
-
 inline void OPNABase::LFO()
 {
 //	LOG3("%4d - %8d, %8d\n", c, lfocount, lfodcount);
@@ -1149,31 +1117,72 @@ inline void OPNABase::LFO()
 
 // ---------------------------------------------------------------------------
 //	合成
+//	FM_BLOCKSIZE サンプルずつ，チャンネルごとにまとめて合成する．
+//	チャンネル同士は独立しているので，1 サンプルごとに全チャンネルを
+//	計算した場合と結果は変わらない
 //
 #define IStoSample(s)	((Limit(s, 0x7fff, -0x8000) * fmvolume) >> 14)
 
 void OPNABase::Mix6(Sample* buffer, int nsamples, int activech)
 {
-	// Mix
-	ISample ibuf[4];
-	ISample* idest[6];
-	idest[0] = &ibuf[pan[0]];
-	idest[1] = &ibuf[pan[1]];
-	idest[2] = &ibuf[pan[2]];
-	idest[3] = &ibuf[pan[3]];
-	idest[4] = &ibuf[pan[4]];
-	idest[5] = &ibuf[pan[5]];
-
-	Sample* limit = buffer + nsamples * 2;
-	for (Sample* dest = buffer; dest < limit; dest+=2)
+	ISample lbuf[FM_BLOCKSIZE];
+	ISample rbuf[FM_BLOCKSIZE];
+	ISample cbuf[FM_BLOCKSIZE];
+	uint8 aml[FM_BLOCKSIZE];
+	uint8 pml[FM_BLOCKSIZE];
+	bool lfo = (activech & 0xaaa) != 0;
+
+	for (; nsamples > 0; nsamples -= FM_BLOCKSIZE)
 	{
-		ibuf[1] = ibuf[2] = ibuf[3] = 0;
-		if (activech & 0xaaa)
-			LFO(), MixSubSL(activech, idest);
-		else
-			MixSubS(activech, idest);
-		StoreSample(dest[0], IStoSample(ibuf[2] + ibuf[3]));
-		StoreSample(dest[1], IStoSample(ibuf[1] + ibuf[3]));
+		int n = Min(nsamples, FM_BLOCKSIZE);
+		int i;
+
+		// LFO はチップ共通なので先にブロック分の値を求めておく
+		if (lfo)
+		{
+			for (i=0; i<n; i++)
+			{
+				LFO();
+				aml[i] = chip.GetAML();
+				pml[i] = chip.GetPML();
+			}
+		}
+
+		// op[0] の計算は全チャンネルを交互に行う
+		Channel4* act[6];
+		int nact = 0;
+		for (int c=0; c<6; c++)
+		{
+			if (activech & (1 << (c * 2)))
+			{
+				if (lfo)
+					ch[c].BeginBlockL(n, aml, pml);
+				else
+					ch[c].BeginBlock(n);
+				act[nact++] = &ch[c];
+			}
+		}
+		Channel4::CalcBlockFB(act, nact, n);
+
+		memset(lbuf, 0, n * sizeof(ISample));
+		memset(rbuf, 0, n * sizeof(ISample));
+		for (int c=0; c<6; c++)
+		{
+			if (!(activech & (1 << (c * 2))))
+				continue;
+
+			ch[c].EndBlock(cbuf, n);
+			if (pan[c] & 2)
+				for (i=0; i<n; i++) lbuf[i] += cbuf[i];
+			if (pan[c] & 1)
+				for (i=0; i<n; i++) rbuf[i] += cbuf[i];
+		}
+
+		for (i=0; i<n; i++, buffer+=2)
+		{
+			StoreSample(buffer[0], IStoSample(lbuf[i]));
+			StoreSample(buffer[1], IStoSample(rbuf[i]));
+		}
 	}
 }
 
@@ -1771,6 +1780,12 @@ uint OPNB::ReadStatusEx()
 int OPNB::jedi_table[(48+1)*16];
 
 void OPNB::InitADPCMATable()
+{
+	static const bool made = BuildADPCMATable();
+	(void) made;
+}
+
+bool OPNB::BuildADPCMATable()
 {
 	const static int8 table2[] = 
 	{
@@ -1786,6 +1801,7 @@ void OPNB::InitADPCMATable()
 			jedi_table[i*16+j] = s * table2[j] / 8;
 		}
 	}
+	return true;
 }
 
 // ---------------------------------------------------------------------------
@@ -133,6 +133,7 @@ namespace FM
 		virtual void Intr(bool) {}
 
 		void	MakeTable2();
+		static bool	BuildTLTable();
 	
 	protected:
 		bool	Init(uint c, uint r, bool);
@@ -146,9 +147,6 @@ namespace FM
 	protected:
 		void	FMMix(Sample* buffer, int nsamples);
 		void 	Mix6(Sample* buffer, int nsamples, int activech);
-		
-		void	MixSubS(int activech, ISample**);
-		void	MixSubSL(int activech, ISample**);
 
 		void	SetStatus(uint bit);
 		void	ResetStatus(uint bit);
@@ -213,11 +211,9 @@ namespace FM
 
 		Channel4 ch[6];
 
-		static void	BuildLFOTable();
-		static int amtable[FM_LFOENTS];
-		static int pmtable[FM_LFOENTS];
+		static const int amtable[FM_LFOENTS];
+		static const int pmtable[FM_LFOENTS];
 		static int32 tltable[FM_TLENTS+FM_TLPOS];
-		static bool	tablehasmade;
 	};
 
 	//	YM2203(OPN) ----------------------------------------------------
@@ -350,6 +346,7 @@ namespace FM
 		int		DecodeADPCMASample(uint);
 		void	ADPCMAMix(Sample* buffer, uint count);
 		static void InitADPCMATable();
+		static bool BuildADPCMATable();
 		
 	// ADPCMA 関係
 		uint8*	adpcmabuf;		// ADPCMA ROM
@@ -61,28 +61,35 @@ void PSG::SetClock(int clock, int rate)
 
 // ---------------------------------------------------------------------------
 //	ノイズテーブルを作成する
+//	全インスタンスで共有するので最初の一度だけ作る
+//	(関数内 static の初期化は複数のスレッドから呼ばれても一度しか行われない)
 //
 void PSG::MakeNoiseTable()
 {
-	if (!noisetable[0])
+	static const bool made = BuildNoiseTable();
+	(void) made;
+}
+
+bool PSG::BuildNoiseTable()
+{
+	int noise = 14321;
+	for (int i=0; i<noisetablesize; i++)
 	{
-		int noise = 14321;
-		for (int i=0; i<noisetablesize; i++)
+		int n = 0;
+		for (int j=0; j<32; j++)
 		{
-			int n = 0;
-			for (int j=0; j<32; j++)
-			{
-				n = n * 2 + (noise & 1);
-				noise = (noise >> 1) | (((noise << 14) ^ (noise << 16)) & 0x10000);
-			}
-			noisetable[i] = n;
+			n = n * 2 + (noise & 1);
+			noise = (noise >> 1) | (((noise << 14) ^ (noise << 16)) & 0x10000);
 		}
+		noisetable[i] = n;
 	}
+	return true;
 }
 
 // ---------------------------------------------------------------------------
 //	出力テーブルを作成
 //	素直にテーブルで持ったほうが省スペース。
+//	音量ごとに異なるのでインスタンスごとに持つ
 //
 void PSG::SetVolume(int volume)
 {
@@ -357,5 +364,3 @@ void PSG::Mix(Sample* dest, int nsamples)
 //	テーブル
 //
 uint	PSG::noisetable[noisetablesize] = { 0, };
-int		PSG::EmitTable[0x20] = { -1, };
-uint	PSG::enveloptable[16][64] = { 0, };
@@ -68,7 +68,8 @@ public:
 	uint GetReg(uint regnum) { return reg[regnum & 0x0f]; }
 
 protected:
-	void MakeNoiseTable();
+	static void MakeNoiseTable();
+	static bool BuildNoiseTable();
 	void MakeEnvelopTable();
 	static void StoreSample(Sample& dest, int32 data);
 	
@@ -84,9 +85,10 @@ protected:
 	uint32 nperiodbase;
 	int mask;
 
-	static uint enveloptable[16][64];
+	uint enveloptable[16][64];
+	int EmitTable[32];
+
 	static uint noisetable[noisetablesize];
-	static int EmitTable[32];
 };
 
 #endif // PSG_H
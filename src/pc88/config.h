@@ -86,6 +86,11 @@ public:
 		fddnowait		= 1 << 11,	// FDD ノーウェイト
 		usedsnotify		= 1 << 12,
 		saveposition	= 1 << 13,	// 起動時に前回終了時のウインドウ位置を復元
+		lazytextdma		= 1 << 14,	// テキストの DMA を VRTC 時にまとめて行う
+		screenthread	= 1 << 15,	// 画面合成を別スレッドで行う
+		scalescanline	= 1 << 16,	// 拡大時にスキャンラインを付ける
+		scaleaperture	= 1 << 17,	// 拡大時にアパーチャグリルを付ける
+		soundthread		= 1 << 18,	// OPN の合成を別スレッドで行う
 	};
 
 	int flags;
@@ -109,6 +114,7 @@ public:
 	int romeolatency;
 	int winposx;
 	int winposy;
+	int scale;				// ウィンドウ表示時の画面の拡大率 (1-4)
 
 	BASICMode basicmode;
 
@@ -12,6 +12,7 @@
 #include "pc88/config.h"
 #include "pc88/pc88.h"
 #include "schedule.h"
+#include "memmgr.h"
 #include "draw.h"
 #include "misc.h"
 #include "file.h"
@@ -72,6 +73,7 @@ CRTC::CRTC(const ID& id)
 	fontrom = 0;
 	cg80rom = 0;
 	vram[0] = 0;
+	lasttext = 0;
 	pcgram = 0;
 	pcgadr = 0;
 	pcgdat = 0;
@@ -85,6 +87,15 @@ CRTC::CRTC(const ID& id)
 	cursor_y = 0;
 	cursor_type = 0;
 	param1 = 0;
+	mm = 0;
+	mid = -1;
+	lazyline = false;
+	lazyframe = false;
+	lazyhook = false;
+	lazysaved = 0;
+	fontgen = 0;
+	flushcache = false;
+	newattr = false;
 }
 
 CRTC::~CRTC()
@@ -99,9 +110,11 @@ CRTC::~CRTC()
 // ---------------------------------------------------------------------------
 //	初期化
 //
-bool CRTC::Init(IOBus* b, Scheduler* s, PD8257* d, Draw* _draw)
+bool CRTC::Init(IOBus* b, Scheduler* s, PD8257* d, Draw* _draw, MemoryManager* _mm)
 {
-	bus = b, scheduler = s, dmac = d, draw = _draw;
+	bus = b, scheduler = s, dmac = d, draw = _draw, mm = _mm;
+	if (mid < 0)
+		mid = mm->Connect(this, true);
 
 	delete[] font;
 	delete[] fontrom;
@@ -110,7 +123,7 @@ bool CRTC::Init(IOBus* b, Scheduler* s, PD8257* d, Draw* _draw)
 	
 	font = new uint8[0x8000 + 0x10000];
 	fontrom = new uint8[0x800];
-	vram[0] = new uint8[0x1e00+0x1e00+0x1400];
+	vram[0] = new uint8[textsize * 3 + 0x1400];
 	pcgram = new uint8[0x400];
 	
 	if (!font || !fontrom || !vram[0] || !pcgram)
@@ -128,6 +141,8 @@ bool CRTC::Init(IOBus* b, Scheduler* s, PD8257* d, Draw* _draw)
 	
 	vram[1] = vram[0] + 0x1e00;
 	attrcache = vram[1] + 0x1e00;
+	lasttext = attrcache + 0x1400;
+	memset(&presented, 0xff, sizeof(presented));
 	
 	bank = 0;
 	mode = 0;
@@ -144,16 +159,19 @@ bool CRTC::Init(IOBus* b, Scheduler* s, PD8257* d, Draw* _draw)
 //
 void IOCALL CRTC::Out(uint port, uint data)
 {
+	SyncLines();
 	Command((port & 1) != 0, data);
 }
 
 uint IOCALL CRTC::In(uint)
 {
+	SyncLines();
 	return Command(false, 0);
 }
 
 uint IOCALL CRTC::GetStatus(uint)
 {
+	CatchUp();
 	return status;
 }
 
@@ -190,6 +208,7 @@ void CRTC::HotReset()
 	pcount[0] = 0;
 	pcount[1] = 0;
 
+	EndLazyFrame();
 	scheduler->DelEvent(sev);
 	StartDisplay();
 }
@@ -219,6 +238,7 @@ void CRTC::SetTextSize(bool wide)
 {
 	widefont = wide;
 	memset(attrcache, secret, 0x1400);
+	flushcache = true;
 }
 
 // ---------------------------------------------------------------------------
@@ -255,6 +275,7 @@ uint CRTC::Command(bool a0, uint data)
 		case 0:	
 			status = 0;		// 1
 			attr = 7 << 5;
+			newattr = true;
 			mode |= clear;
 			pcount[1] = 0;
 			break;
@@ -440,6 +461,7 @@ void CRTC::CreateTFont(const uint8* src, int idx, int num)
 {
 	uint8* dest = font + 64 * idx;
 	uint8* destw = font + 0x8000 + 128 * idx;
+	fontgen++;
 
 	for (int i=0; i<num*8; i++)
 	{
@@ -456,6 +478,7 @@ void CRTC::ModifyFont(uint off, uint d)
 {
 	uint8* dest = font + 8 * off;
 	uint8* destw = font + 0x8000 + 16 * off;
+	fontgen++;
 	
 	for (uint j=0; j<8; j++, d*=2)
 	{
@@ -474,6 +497,7 @@ void CRTC::CreateGFont()
 	uint8* dest = font + 0x4000;
 	uint8* destw = font + 0x10000;
 	const uint8 order[8] = { 0x01, 0x10, 0x02, 0x20, 0x04, 0x40, 0x08, 0x80 };
+	fontgen++;
 	
 	for (int i=0; i<256; i++)
 	{
@@ -509,9 +533,14 @@ void IOCALL CRTC::StartDisplay(uint)
 	column = 0;
 	mode &= ~suppressdisplay;
 //	LOG0("DisplayStart\n");
+	linebase = scheduler->GetTime();
 	bus->Out(PC88::vrtc, 0);
 	if (++frametime > blinkrate)
 		frametime = 0;
+	if (!frametime)
+		LOG1("lazy: %d events saved\n", lazysaved);
+	if (lazyline && BeginLazyFrame())
+		return;
 	ExpandLine();
 }
 
@@ -611,6 +640,165 @@ inline void IOCALL CRTC::ExpandLineEnd(uint)
 	sev = scheduler->AddEvent(linetime*vretrace, this, STATIC_CAST(TimeFunc, &CRTC::StartDisplay), 0);
 }
 
+// ---------------------------------------------------------------------------
+//	テキスト行の遅延取得 (lazytextdma)
+//	表示開始時にはイベントを 1 つだけ登録し，表示期間の終わりにまとめて
+//	全行の DMA を行う．表示期間中に CRTC/DMAC/TVRAM が操作された場合は
+//	その時点までに取得されているべき行を取得し，残りの行は通常どおり
+//	行単位のイベントで処理する．
+//	24kHz/25 行の場合 1 フレームあたり 23 個 (約 1300 個/秒) のイベントが省略される．
+//
+bool CRTC::BeginLazyFrame()
+{
+	if (mid < 0 || height < 2)
+		return false;
+
+	// DMA の転送元が TVRAM (f000h-) 以外の場合は監視しきれないので対象外
+	uint top = 0x10000;
+	if (status & 0x10)
+	{
+		uint ptr = dmac->GetPtr(dmabank);
+		top = dmac->IsAutoInit() ? Min(ptr, dmac->GetPtr(dmabank+1)) : ptr;
+		if (top < 0xf000 || ptr + linesize * height > 0x10000)
+			return false;
+	}
+
+	lazyframe = true;
+	lazytop = top;
+	
+	// 監視用の書き込み関数を TVRAM とテキストウインドウに割り当てる
+	hooktop = Min(top, 0xfc00) & ~0x3ff;
+	mm->AllocW(mid, 0x8000, 0x400, WrTVRAM);
+	mm->AllocW(mid, hooktop, 0x10000 - hooktop, WrTVRAM);
+	lazyhook = true;
+
+	FetchLines(0);
+	sev = scheduler->AddEvent(linetime * (height-1), this, 
+						STATIC_CAST(TimeFunc, &CRTC::ExpandLineLazy));
+	lazysaved--;
+	return true;
+}
+
+void CRTC::EndLazyFrame()
+{
+	lazyframe = false;
+	if (lazyhook)
+	{
+		mm->ReleaseW(mid, 0x8000, 0x400);
+		mm->ReleaseW(mid, hooktop, 0x10000 - hooktop);
+		lazyhook = false;
+	}
+}
+
+// ---------------------------------------------------------------------------
+//	表示期間の終わりに残りの行をまとめて取得する
+//
+void IOCALL CRTC::ExpandLineLazy(uint)
+{
+	FetchLines(height);
+	EndLazyFrame();
+	ExpandLineEnd();
+}
+
+// ---------------------------------------------------------------------------
+//	last 行目までを取得する
+//
+void CRTC::FetchLines(uint last)
+{
+	for (; column <= last && column < height; column++)
+	{
+		if (column)
+			lazysaved++;
+		if (ExpandLineSub())
+		{
+			column = height;
+			break;
+		}
+	}
+}
+
+// ---------------------------------------------------------------------------
+//	現在時刻までに取得されているべき行を取得する
+//
+void CRTC::CatchUp()
+{
+	if (lazyframe)
+	{
+		int t = scheduler->GetTime() - linebase;
+		if (t > 0)
+			FetchLines(t / linetime);
+	}
+}
+
+// ---------------------------------------------------------------------------
+//	現在表示中のライン (0-399) を返す
+//	表示期間外なら -1
+//
+int CRTC::GetRasterLine()
+{
+	int t = scheduler->GetTime() - linebase;
+	if (t < 0 || linetime <= 0 || t >= linetime * int(height))
+		return -1;
+	int y = t * int(linesperchar) / linetime;
+	return y < int(screenheight) ? y : -1;
+}
+
+// ---------------------------------------------------------------------------
+//	lazy モードを中断し，残りの行を行単位のイベントで処理する
+//
+void CRTC::SyncLines()
+{
+	if (!lazyframe)
+		return;
+
+	CatchUp();
+	EndLazyFrame();
+	scheduler->DelEvent(sev);
+
+	int t = scheduler->GetTime() - linebase;
+	if (column < height)
+	{
+		event = 1;
+		sev = scheduler->AddEvent(Max(1, int(column) * linetime - t), this, 
+							STATIC_CAST(TimeFunc, &CRTC::ExpandLine));
+	}
+	else
+	{
+		int e = Max(1, int(height-1) * linetime - t);
+		event = (e + linetime - 1) / linetime + 1;
+		sev = scheduler->AddEvent(e, this, 
+							STATIC_CAST(TimeFunc, &CRTC::ExpandLineEnd));
+	}
+}
+
+// ---------------------------------------------------------------------------
+//	DMAC へのアクセスの直前に呼ばれる
+//
+void IOCALL CRTC::SyncOut(uint, uint)
+{
+	SyncLines();
+}
+
+uint IOCALL CRTC::SyncIn(uint)
+{
+	CatchUp();
+	return 0xff;
+}
+
+// ---------------------------------------------------------------------------
+//	lazy モード中の TVRAM/テキストウインドウへの書き込み
+//
+void MEMCALL CRTC::WrTVRAM(void* inst, uint addr, uint data)
+{
+	CRTC* c = STATIC_CAST(CRTC*, inst);
+	uint a = addr;
+	if ((addr & 0xfc00) == 0x8000)
+		a = ((c->bus->In(0x70) << 8) + (addr & 0x3ff)) & 0xffff;
+	if (a >= c->lazytop)
+		c->SyncLines();
+	c->mm->Write8P(c->mid, addr, data);
+}
+
 // ---------------------------------------------------------------------------
 //	画面サイズ変更の必要があれば変更
 //
@@ -624,14 +812,17 @@ void CRTC::SetSize()
 //
 void CRTC::UpdateScreen(uint8* image, int _bpl, Draw::Region& region, bool ref)
 {
+	CatchUp();
 	bpl = _bpl;
 	Log("UpdateScreen:");
+	const uint8* text = vram[bank];
 	if (mode & clear)
 	{
 		Log(" clear\n");
 		mode &= ~(clear | refresh);
 		ClearText(image);
 		region.Update(0, screenheight);
+		SetPresented(text);
 		return;
 	}
 	if (mode & resize)
@@ -653,17 +844,7 @@ void CRTC::UpdateScreen(uint8* image, int _bpl, Draw::Region& region, bool ref)
 //	statusdisplay.Show(10, 0, "CRTC: %.2x %.2x %.2x", status, mode, attr);
 	if (status & 0x10)
 	{
-		static const uint8 ctype[5] =
-		{
-			0, underline, underline, reverse, reverse
-		};
-
-		if ((cursor_type & 1) && ( (frametime <= blinkrate/4) ||  (blinkrate/2 <= frametime && frametime <= 3*blinkrate/4)))
-			attr_cursor = 0;
-		else
-			attr_cursor = ctype[1 + cursor_type];
-
-		attr_blink = frametime < blinkrate / 4 ? secret : 0;
+		GetBlinkAttr(&attr_cursor, &attr_blink);
 		underlineptr = (linesperchar-1) * bpl;
 
 		Log(" update");
@@ -671,9 +852,88 @@ void CRTC::UpdateScreen(uint8* image, int _bpl, Draw::Region& region, bool ref)
 //		LOG4("time: %d  cursor: %d(%d)  blink: %d\n", frametime, attr_cursor, cursor_type, attr_blink);
 		ExpandImage(image, region);
 	}
+	SetPresented(text);
 	Log("\n");
 }
 
+// ---------------------------------------------------------------------------
+//	現在のフレームでのカーソルとブリンクのアトリビュート
+//
+void CRTC::GetBlinkAttr(uint8* cursor, uint8* blink)
+{
+	static const uint8 ctype[5] =
+	{
+		0, underline, underline, reverse, reverse
+	};
+
+	if ((cursor_type & 1) && ( (frametime <= blinkrate/4) ||  (blinkrate/2 <= frametime && frametime <= 3*blinkrate/4)))
+		*cursor = 0;
+	else
+		*cursor = ctype[1 + cursor_type];
+
+	*blink = frametime < blinkrate / 4 ? secret : 0;
+}
+
+// ---------------------------------------------------------------------------
+//	テキスト画面の状態を取り出す
+//
+void CRTC::GetTextState(TextState* s)
+{
+	memset(s, 0, sizeof(TextState));
+	s->mode = mode;
+	s->status = status;
+	s->screenheight = screenheight;
+	s->width = width;
+	s->height = height;
+	s->linesize = linesize;
+	s->attrperline = attrperline;
+	s->linesperchar = linesperchar;
+	s->cursor_x = cursor_x;
+	s->cursor_y = cursor_y;
+	s->fontgen = fontgen;
+	s->attr = attr;
+	s->widefont = widefont;
+	if (status & 0x10)
+		GetBlinkAttr(&s->attr_cursor, &s->attr_blink);
+}
+
+// ---------------------------------------------------------------------------
+//	合成したテキストと状態を覚えておく
+//
+void CRTC::SetPresented(const uint8* text)
+{
+	memcpy(lasttext, text, Min(linesize * height, uint(textsize)));
+	GetTextState(&presented);
+}
+
+// ---------------------------------------------------------------------------
+//	前回合成した時からテキスト画面が変化した行数を返す
+//	行の内容によらず全体を書き直す変化なら全体の行数を返す
+//
+int CRTC::GetChangedRows()
+{
+	CatchUp();
+
+	int rows = Max(1, Min(screenheight / Max(linesperchar, 1), height));
+	TextState s;
+	GetTextState(&s);
+	if (memcmp(&s, &presented, sizeof(TextState)))
+		return rows;
+	if (!(status & 0x10))
+		return 0;
+
+	int n = 0;
+	uint size = Min(linesize * height, uint(textsize));
+	const uint8* src = vram[bank];
+	const uint8* last = lasttext;
+	for (uint y=0; y<size; y+=linesize)
+	{
+		if (memcmp(src + y, last + y, Min(linesize, size - y)))
+			n++;
+	}
+	return n;
+}
+
 // ---------------------------------------------------------------------------
 //	テキスト画面消去
 //
@@ -1166,6 +1426,111 @@ void CRTC::ApplyConfig(const Config* cfg)
 {
 	kanaenable = cfg->basicmode == Config::N80V2;
 	EnablePCG((cfg->flags & Config::enablepcg) != 0);
+	lazyline = (cfg->flag2 & Config::lazytextdma) != 0;
+	if (!lazyline)
+		SyncLines();
+}
+
+// ---------------------------------------------------------------------------
+//	画面合成専用のインスタンスとして初期化する
+//	src		フォントと attr の初期値を取得する CRTC
+//
+bool CRTC::InitComposer(const CRTC* src)
+{
+	delete[] font;
+	delete[] vram[0];
+	
+	font = new uint8[fontsize];
+	vram[0] = new uint8[textsize * 3 + 0x1400];
+	if (!font || !vram[0])
+	{
+		Error::SetError(Error::OutOfMemory);
+		return false;
+	}
+	vram[1] = vram[0] + textsize;
+	attrcache = vram[1] + textsize;
+	lasttext = attrcache + 0x1400;
+	memset(&presented, 0xff, sizeof(presented));
+	memset(vram[0], 0, textsize * 2);
+	memset(attrcache, secret, 0x1400);
+
+	memcpy(font, src->font, fontsize);
+	fontgen = src->fontgen;
+	attr = src->attr;
+	bank = 0;
+	mode = clear;
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+//	画面合成に必要な状態を取り出す
+//	text		現在のバンクのテキスト (textsize バイト)
+//	fontimage	フォントの写しを取る場合はその領域 (fontsize バイト)
+//	clear/refresh/resize は取り出した側で処理するのでリセットする
+//
+void CRTC::Capture(Frame* f, uint8* text, uint8* fontimage)
+{
+	CatchUp();
+	f->mode = mode;
+	f->status = status;
+	f->screenheight = screenheight;
+	f->width = width;
+	f->height = height;
+	f->linesize = linesize;
+	f->attrperline = attrperline;
+	f->linesperchar = linesperchar;
+	f->cursor_x = cursor_x;
+	f->cursor_y = cursor_y;
+	f->cursor_type = cursor_type;
+	f->blinkrate = blinkrate;
+	f->frametime = frametime;
+	f->pat_mask = pat_mask;
+	f->pat_rev = pat_rev;
+	f->widefont = widefont;
+	f->flushcache = flushcache;
+	f->newattr = newattr;
+	f->attr = attr;
+	f->fontgen = fontgen;
+	mode &= ~(clear | refresh | resize);
+	flushcache = false;
+	newattr = false;
+
+	memcpy(text, vram[bank], Min(linesize * height, uint(textsize)));
+	if (fontimage)
+		memcpy(fontimage, font, fontsize);
+	SetPresented(vram[bank]);
+}
+
+// ---------------------------------------------------------------------------
+//	Capture で取り出した状態を反映する
+//
+void CRTC::Restore(const Frame* f, const uint8* text, const uint8* fontimage)
+{
+	mode = f->mode | (mode & (clear | refresh | resize));
+	status = f->status;
+	screenheight = f->screenheight;
+	width = f->width;
+	height = f->height;
+	linesize = f->linesize;
+	attrperline = f->attrperline;
+	linesperchar = f->linesperchar;
+	cursor_x = f->cursor_x;
+	cursor_y = f->cursor_y;
+	cursor_type = f->cursor_type;
+	blinkrate = f->blinkrate;
+	frametime = f->frametime;
+	pat_mask = f->pat_mask;
+	pat_rev = f->pat_rev;
+	widefont = f->widefont;
+	if (f->flushcache)
+		memset(attrcache, secret, 0x1400);
+	if (f->newattr)
+		attr = f->attr;
+	if (fontimage)
+		memcpy(font, fontimage, fontsize);
+	fontgen = f->fontgen;
+
+	memcpy(vram[bank], text, Min(linesize * height, uint(textsize)));
 }
 
 // ---------------------------------------------------------------------------
@@ -1187,6 +1552,7 @@ uint IFCALL CRTC::GetStatusSize()
 bool IFCALL CRTC::SaveStatus(uint8* s)
 {
 	LOG0("*** Save Status\n");
+	SyncLines();
 	Status* st = (Status*) s;
 	
 	st->rev = ssrev;
@@ -1223,12 +1589,14 @@ bool IFCALL CRTC::LoadStatus(const uint8* s)
 	cursor_y = st->cursor_y;
 	cursor_type = st->cursor_t;
 	attr = st->attr;
+	newattr = true;
 	column = st->column;
 	mode = st->mode;
 	status = st->status | clear;
 	event = st->event;
 	SetTextMode(st->color);
 	
+	EndLazyFrame();
 	scheduler->DelEvent(sev);
 	if (event == 1)
 		sev = scheduler->AddEvent(linetime, this, STATIC_CAST(TimeFunc, &CRTC::ExpandLine));
@@ -1251,10 +1619,12 @@ const Device::OutFuncPtr CRTC::outdef[] =
 	STATIC_CAST(Device::OutFuncPtr, &Out),
 	STATIC_CAST(Device::OutFuncPtr, &PCGOut),
 	STATIC_CAST(Device::OutFuncPtr, &SetKanaMode),
+	STATIC_CAST(Device::OutFuncPtr, &SyncOut),
 };
 
 const Device::InFuncPtr CRTC::indef[] = 
 {
 	STATIC_CAST(Device::InFuncPtr, &In),
 	STATIC_CAST(Device::InFuncPtr, &GetStatus),
+	STATIC_CAST(Device::InFuncPtr, &SyncIn),
 };
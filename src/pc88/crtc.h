@@ -13,6 +13,7 @@
 #include "schedule.h"
 
 class Scheduler;
+class MemoryManager;
 
 namespace PC8801
 {
@@ -27,17 +28,44 @@ class CRTC : public Device
 public:
 	enum IDOut
 	{
-		reset=0, out, pcgout, setkanamode
+		reset=0, out, pcgout, setkanamode, syncout
 	};
 	enum IDIn
 	{
-		in = 0, getstatus,
+		in = 0, getstatus, syncin
+	};
+	enum
+	{
+		fontsize = 0x8000 + 0x10000,
+		textsize = 0x1e00,
+	};
+
+	// 画面合成に必要な状態 (ScreenPipe 用)
+	struct Frame
+	{
+		uint mode;
+		uint status;
+		uint screenheight;
+		uint width, height;
+		uint linesize;
+		uint attrperline;
+		uint linesperchar;
+		uint cursor_x, cursor_y;
+		int cursor_type;
+		uint blinkrate;
+		uint frametime;
+		packed pat_mask, pat_rev;
+		bool widefont;
+		bool flushcache;		// attrcache を無効にする
+		bool newattr;			// attr を再設定する
+		uint8 attr;
+		uint fontgen;
 	};
 
 public:
 	CRTC(const ID& id);
 	~CRTC();
-	bool Init(IOBus* bus, Scheduler* s, PD8257* dmac, Draw* draw);
+	bool Init(IOBus* bus, Scheduler* s, PD8257* dmac, Draw* draw, MemoryManager* mm);
 	const Descriptor* IFCALL GetDesc() const { return &descriptor; }
 	
 	void UpdateScreen(uint8* image, int bpl, Draw::Region& region, bool refresh);
@@ -45,6 +73,13 @@ public:
 	void ApplyConfig(const Config* config);
 	int GetFramePeriod();
 
+	bool InitComposer(const CRTC* src);
+	void Capture(Frame* frame, uint8* text, uint8* fontimage);
+	void Restore(const Frame* frame, const uint8* text, const uint8* fontimage);
+	uint GetFontGeneration() { return fontgen; }
+	int GetRasterLine();
+	int GetChangedRows();
+
 	uint IFCALL GetStatusSize();
 	bool IFCALL SaveStatus(uint8* status);
 	bool IFCALL LoadStatus(const uint8* status);
@@ -56,6 +91,8 @@ public:
 	uint IOCALL GetStatus(uint=0);
 	void IOCALL PCGOut(uint, uint);
 	void IOCALL SetKanaMode(uint, uint);
+	void IOCALL SyncOut(uint, uint);
+	uint IOCALL SyncIn(uint);
 	
 	void SetTextMode(bool color);
 	void SetTextSize(bool wide);
@@ -114,6 +151,25 @@ private:
 		bool color;
 	};
 
+	// 前回合成した時のテキスト画面の状態 (行の内容を除く)
+	// 比較に使うので未使用部分も 0 にしておく
+	struct TextState
+	{
+		uint mode;
+		uint status;
+		uint screenheight;
+		uint width, height;
+		uint linesize;
+		uint attrperline;
+		uint linesperchar;
+		uint cursor_x, cursor_y;
+		uint fontgen;
+		uint8 attr;
+		uint8 attr_cursor;
+		uint8 attr_blink;
+		bool widefont;
+	};
+
 	void HotReset();
 	bool LoadFontFile();
 	void CreateTFont();
@@ -127,7 +183,18 @@ private:
 	void IOCALL ExpandLineEnd(uint=0);
 	int  ExpandLineSub();
 
+	bool BeginLazyFrame();
+	void EndLazyFrame();
+	void IOCALL ExpandLineLazy(uint=0);
+	void FetchLines(uint last);
+	void CatchUp();
+	void SyncLines();
+	static void MEMCALL WrTVRAM(void* inst, uint addr, uint data);
+
 	void ClearText(uint8* image);
+	void GetBlinkAttr(uint8* cursor, uint8* blink);
+	void GetTextState(TextState* s);
+	void SetPresented(const uint8* text);
 	void ExpandImage(uint8* image, Draw::Region& region);
 	void ExpandAttributes(uint8* dest, const uint8* src, uint y);
 	void ChangeAttr(uint8 code);
@@ -154,6 +221,8 @@ private:
 	Scheduler* scheduler;
 	Scheduler::Event* sev;
 	Draw* draw;
+	MemoryManager* mm;
+	int mid;
 
 	int cmdm, cmdc;
 	uint cursormode;
@@ -181,6 +250,8 @@ private:
 	uint8* pcgram;
 	uint8* vram[2];
 	uint8* attrcache;
+	uint8* lasttext;		// 前回合成したテキスト
+	TextState presented;	// 前回合成した時の状態
 
 	uint bank;				// VRAM Cache のバンク
 //	uint tvramsize;			// 1画面のテキストサイズ
@@ -208,6 +279,18 @@ private:
 	uint8 param1;
 	uint8 event;
 
+	bool lazyline;			// テキスト行の DMA をまとめて行う
+	bool lazyframe;			// 現在のフレームは lazy モードで処理中
+	bool lazyhook;			// TVRAM への書き込みを監視中
+	int linebase;			// 表示開始時刻
+	uint lazytop;			// 監視するアドレスの下限
+	uint hooktop;			// 監視しているページの先頭
+	int lazysaved;			// 省略したイベントの数
+
+	uint fontgen;			// フォントを書き換えるたびに増える
+	bool flushcache;		// SetTextSize で attrcache を無効にした
+	bool newattr;			// attr が再設定された
+
 private:
 	static const Descriptor descriptor;
 	static const InFuncPtr  indef[];
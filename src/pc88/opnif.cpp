@@ -6,6 +6,7 @@
 
 #include "headers.h"
 #include "pc88/opnif.h"
+#include "pc88/opnpipe.h"
 #include "pc88/config.h"
 #include "misc.h"
 #include "schedule.h"
@@ -44,12 +45,18 @@ OPNIF::OPNIF(const ID& id)
 	nextcount = 0;
 	fmmixmode = true;
 	imaskport = 0;
+	pipe = 0;
+	usepipe = false;
+	piperestart = false;
+	channelmask = 0;
+	memset(&volume, 0, sizeof(volume));
 
 	delay = 100000;
 }
 
 OPNIF::~OPNIF()
 {
+	delete pipe;
 	Piccolo::DeleteInstance();
 	Connect(0);
 }
@@ -80,11 +87,11 @@ bool OPNIF::Init(IOBus* b, int intrport, int io, Scheduler* s)
 			switch ( piccolo->IsDriverBased() ) {
 			  case 1:
 				statusdisplay.Show(100, 10000, "ROMEO/GIMIC: YMF288 enabled");
-				opn.SetChannelMask(0xfdff);
+				SetChannelMask(0xfdff);
 				break;
 			  case 2:
 				statusdisplay.Show(100, 10000, "GIMIC: YM2608 enabled");
-				opn.SetChannelMask(0xffff);
+				SetChannelMask(0xffff);
 				break;
 			  default:
 			  case 0:
@@ -128,6 +135,7 @@ bool IFCALL OPNIF::SetRate(uint rate)
 	opn.SetReg(prescaler, 0);
 	opn.SetRate(clock, rate, fmmixmode);
 	currentrate = rate;
+	piperestart = true;
 	return true;
 }
 
@@ -146,7 +154,51 @@ void OPNIF::SetFMMixMode(bool mm)
 void IFCALL OPNIF::Mix(int32* dest, int nsamples)
 {
 	if (enable)
-		opn.Mix(dest, nsamples);
+	{
+		CriticalSection::Lock lock(cs);
+		if (pipe)
+		{
+			pipe->Mix(dest, nsamples, scheduler->GetTime());
+			opn.SkipADPCMB(nsamples);
+		}
+		else
+			opn.Mix(dest, nsamples);
+	}
+}
+
+// ---------------------------------------------------------------------------
+//	合成スレッドの作成・破棄
+//	ジャーナルに書くのは VM のスレッドだけなので，VM のスレッドで行う
+//	作り直すと合成側の音源はレジスタの内容から復元するので，
+//	鳴っている音は次のキーオンまで途切れる
+//
+void OPNIF::UpdatePipe()
+{
+	bool use = usepipe && enable;
+	if (use == (pipe != 0) && !(pipe && piperestart))
+		return;
+
+	CriticalSection::Lock lock(cs);
+	piperestart = false;
+	delete pipe;
+	pipe = 0;
+	if (use)
+	{
+		OPNPipe* p = new OPNPipe;
+		if (p && p->Init(this, scheduler->GetTime()))
+			pipe = p;
+		else
+			delete p, usepipe = false;
+	}
+}
+
+// ---------------------------------------------------------------------------
+//	合成スレッドへの書き込み
+//
+inline void OPNIF::Journal(uint addr, uint data)
+{
+	if (pipe)
+		pipe->Write(scheduler->GetTime(), addr, data);
 }
 
 // ---------------------------------------------------------------------------
@@ -157,20 +209,36 @@ static inline int ConvertVolume(int volume)
 	return volume > -40 ? volume : -200;
 }
 
-void OPNIF::SetVolume(const Config* config)
+void OPNIF::OPNUnit::SetVolume(const Volume& v)
 {
-	opn.SetVolumeFM(ConvertVolume(config->volfm));
-	opn.SetVolumePSG(ConvertVolume(config->volssg));
+	SetVolumeFM(v.fm);
+	SetVolumePSG(v.psg);
 #ifndef USE_OPN
-	opn.SetVolumeADPCM(ConvertVolume(config->voladpcm));
-	opn.SetVolumeRhythmTotal(ConvertVolume(config->volrhythm));
-	opn.SetVolumeRhythm(0, ConvertVolume(config->volbd));
-	opn.SetVolumeRhythm(1, ConvertVolume(config->volsd));
-	opn.SetVolumeRhythm(2, ConvertVolume(config->voltop));
-	opn.SetVolumeRhythm(3, ConvertVolume(config->volhh));
-	opn.SetVolumeRhythm(4, ConvertVolume(config->voltom));
-	opn.SetVolumeRhythm(5, ConvertVolume(config->volrim));
+	SetVolumeADPCM(v.adpcm);
+	SetVolumeRhythmTotal(v.rhythm);
+	for (int i=0; i<6; i++)
+		SetVolumeRhythm(i, v.inst[i]);
 #endif
+}
+
+void OPNIF::SetVolume(const Config* config)
+{
+	volume.fm = ConvertVolume(config->volfm);
+	volume.psg = ConvertVolume(config->volssg);
+	volume.adpcm = ConvertVolume(config->voladpcm);
+	volume.rhythm = ConvertVolume(config->volrhythm);
+	volume.inst[0] = ConvertVolume(config->volbd);
+	volume.inst[1] = ConvertVolume(config->volsd);
+	volume.inst[2] = ConvertVolume(config->voltop);
+	volume.inst[3] = ConvertVolume(config->volhh);
+	volume.inst[4] = ConvertVolume(config->voltom);
+	volume.inst[5] = ConvertVolume(config->volrim);
+	opn.SetVolume(volume);
+	{
+		CriticalSection::Lock lock(cs);
+		if (pipe)
+			pipe->SetVolume(volume);
+	}
 
 	if (chip)
 	{
@@ -193,6 +261,7 @@ void IOCALL OPNIF::Reset(uint, uint)
 	opn.Reset();
 	opn.SetIntrMask(true);
 	prescaler = 0x2d;
+	Journal(OPNPipe::cmdreset, 0);
 
 	if (chip)
 		chip->Reset(opnamode);
@@ -223,6 +292,50 @@ inline void OPNIF::OPNUnit::SetIntrMask(bool en)
 		bus->Out(pintr, true);
 }
 
+// ---------------------------------------------------------------------------
+//	CSM モードのキーオン
+//	合成スレッドの音源はタイマーを動かさないので，キーオンを伝える
+//
+void OPNIF::OPNUnit::TimerA()
+{
+	if ((regtc & 0xc0) == 0x80)
+	{
+		csmch->KeyOnCsm(0x0f);
+		csmkeyon = true;
+	}
+}
+
+// ---------------------------------------------------------------------------
+//	ADPCM の再生位置だけを進める
+//	合成スレッドを使う時も，EOS などのステータスは VM 側の音源で作る
+//
+void OPNIF::OPNUnit::SkipADPCMB(int nsamples)
+{
+#ifndef USE_OPN
+	FM::Sample buf[2 * 256];
+	while (adpcmplay && nsamples > 0)
+	{
+		int n = Min(nsamples, 256);
+		memset(buf, 0, 2 * n * sizeof(FM::Sample));
+		ADPCMBMix(buf, n);
+		nsamples -= n;
+	}
+#endif
+}
+
+// ---------------------------------------------------------------------------
+//	チャンネルマスク
+//
+void OPNIF::SetChannelMask(uint mask)
+{
+	channelmask = mask;
+	opn.SetChannelMask(mask);
+
+	CriticalSection::Lock lock(cs);
+	if (pipe)
+		pipe->SetChannelMask(mask);
+}
+
 void OPNIF::SetIntrMask(uint port, uint intrmask)
 {
 //	LOG2("Intr enabled (%.2x)[%.2x]\n", a, intrmask);
@@ -244,6 +357,7 @@ void IOCALL OPNIF::SetIndex0(uint a, uint data)
 		regs[0x2f] = 1;
 		prescaler = data;
 		opn.SetReg(data, 0);
+		Journal(data, 0);
 	}
 }
 
@@ -282,6 +396,7 @@ void IOCALL OPNIF::WriteData0(uint a, uint data)
 		}
 		regs[index0] = data;
 		opn.SetReg(index0, data);
+		Journal(index0, data);
 #if ROMEO_JULIET
 		if (ROMEOEnabled())
 			juliet_YMF288A(index0, data);
@@ -308,6 +423,7 @@ void IOCALL OPNIF::WriteData1(uint a, uint data)
 		data1 = data;
 		regs[0x100 | index1] = data;
 		opn.SetReg(0x100 | index1, data);
+		Journal(0x100 | index1, data);
 		
 		if (chip)
 			chip->SetReg(ChipTime(), 0x100 | index1, data);
@@ -340,7 +456,10 @@ uint IOCALL OPNIF::ReadData1(uint a)
 	if (enable && opnamode)
 	{
 		if (index1 == 0x08)
+		{
 			ret = opn.GetReg(0x100 | index1);
+			Journal(OPNPipe::cmdread, index1);
+		}
 		else
 			ret = data1;
 	}
@@ -392,11 +511,18 @@ void IOCALL OPNIF::TimeEvent(uint e)
 	if (enable)
 	{
 		LOG3("%.8x:TimeEvent(%d) : diff:%d\n", currenttime, e, diff);
+		UpdatePipe();
 		
-		if (soundcontrol)
+		// 合成スレッドを使う時は，書き込みのたびに合成を追いつかせる必要はない
+		if (soundcontrol && (!pipe || e))
 			soundcontrol->Update(this);
 		if (opn.Count(diff * 10) || e)
 			UpdateTimer();
+		if (opn.csmkeyon)
+		{
+			opn.csmkeyon = false;
+			Journal(OPNPipe::cmdcsm, 0);
+		}
 	}
 }
 
@@ -494,6 +620,9 @@ bool IFCALL OPNIF::LoadStatus(const uint8* s)
 	if (opnamode)
 		memcpy(opn.GetADPCMBuffer(), s + sizeof(Status), 0x40000);
 #endif
+	// 合成スレッドの音源は復元した状態から作り直す
+	piperestart = true;
+	UpdatePipe();
 	UpdateTimer();
 	return true;
 }
@@ -7,6 +7,7 @@
 #pragma once
 
 #include "device.h"
+#include "critsect.h"
 #include "opna.h"
 
 // ---------------------------------------------------------------------------
@@ -21,6 +22,7 @@ class PiccoloChip;
 namespace PC8801
 {
 class Config;
+class OPNPipe;
 // ---------------------------------------------------------------------------
 //	88 用の OPN Unit
 //
@@ -54,6 +56,7 @@ public:
 	
 	void SetVolume(const Config* config);
 	void SetFMMixMode(bool);
+	void SetSoundThread(bool f) { usepipe = f; }
 	
 	uint IFCALL GetStatusSize();
 	bool IFCALL SaveStatus(uint8* status);
@@ -79,6 +82,12 @@ public:
 	const Descriptor* IFCALL GetDesc() const { return &descriptor; }
 
 private:
+	struct Volume
+	{
+		int fm, psg, adpcm, rhythm;
+		int inst[6];					// リズム音源の各楽器
+	};
+
 	class OPNUnit : 
 #ifndef USE_OPN
 	public FM::OPNA
@@ -87,18 +96,24 @@ private:
 #endif
 	{
 	public:
-		OPNUnit() : bus(0) {}
+		OPNUnit() : bus(0), csmkeyon(false) {}
 		~OPNUnit() {}
 		void Intr(bool f);
 		void SetIntr(IOBus* b, int p) { bus = b, pintr = p; }
 		void SetIntrMask(bool e);
 		uint IntrStat() { return (intrenabled ? 1 : 0) | (intrpending ? 2 : 0); }
+		void SetVolume(const Volume& v);
+		void KeyOnCsm() { csmch->KeyOnCsm(0x0f); }
+		void SkipADPCMB(int nsamples);
 
 	private:
+		void TimerA();
+
 		IOBus* bus;
 		int pintr;
 		bool intrenabled;
 		bool intrpending;
+		bool csmkeyon;					// CSM モードのキーオンがあった
 
 		friend class OPNIF;
 	};
@@ -119,6 +134,8 @@ private:
 	void UpdateTimer();
 	void IOCALL TimeEvent(uint);
 	uint ChipTime();
+	void UpdatePipe();
+	void Journal(uint addr, uint data);
 #if 0
 	bool ROMEOInit();
 	bool ROMEOEnabled() { return romeo_user == this; }
@@ -152,6 +169,14 @@ private:
 	
 	uint8 regs[0x200];
 
+	Volume volume;
+	uint channelmask;
+
+	OPNPipe* pipe;					// 合成スレッド (使わない時は 0)
+	volatile bool usepipe;			// 合成スレッドを使う
+	volatile bool piperestart;		// 合成スレッドの音源を作り直す
+	CriticalSection cs;				// pipe の作成・破棄と Mix の排他
+
 	static int prescaler;
 
 //	static OPNIF* romeo_user;
@@ -159,14 +184,9 @@ private:
 	static const Descriptor descriptor;
 	static const InFuncPtr  indef[];
 	static const OutFuncPtr outdef[];
-};
-
-
-inline void OPNIF::SetChannelMask(uint ch)
-{
-	opn.SetChannelMask(ch);
-}
 
+	friend class OPNPipe;
+};
 
 }
 
@@ -0,0 +1,356 @@
+﻿// ---------------------------------------------------------------------------
+//	M88 - PC-8801 Emulator.
+// ---------------------------------------------------------------------------
+//	OPN/OPNA 合成スレッド
+// ---------------------------------------------------------------------------
+
+#include "headers.h"
+#include "pc88/opnpipe.h"
+#include "misc.h"
+#include "error.h"
+
+#define LOGNAME "opnpipe"
+#include "diag.h"
+
+using namespace PC8801;
+
+//	ジャーナル・要求・出力のリングの位置は単調に増やし，参照する時に
+//	大きさ (2^n) で剰余を取る．書き手は内容を書いてから位置を進め，
+//	読み手は位置を見てから内容を読む．位置は volatile なので，
+//	VC の x86/x64 ではこの順序が保たれる．
+
+// ---------------------------------------------------------------------------
+//	構築/消滅
+//
+OPNPipe::OPNPipe()
+{
+	journal = 0;
+	output = 0;
+	jwrite = jread = 0;
+	rwrite = rread = 0;
+	owrite = oread = 0;
+	latency = 0;
+	mixtime = rendertime = 0;
+	waited = 0;
+	hthread = 0;
+	idthread = 0;
+	hevent = 0;
+	hrendered = 0;
+	shouldterminate = false;
+}
+
+OPNPipe::~OPNPipe()
+{
+	Cleanup();
+}
+
+// ---------------------------------------------------------------------------
+//	初期化
+//	src の音源と同じ状態の音源を用意して合成スレッドを起動する
+//	time:	現在の時刻 (Scheduler::GetTime)
+//
+bool OPNPipe::Init(OPNIF* src, int time)
+{
+	journal = new Entry[journalsize];
+	output = new int32[2 * outputsize];
+	if (!journal || !output)
+	{
+		Error::SetError(Error::OutOfMemory);
+		return false;
+	}
+	if (!opn.Init(src->clock, 8000, 0))
+		return false;
+	opn.SetReg(OPNIF::prescaler, 0);
+	opn.SetRate(src->clock, src->currentrate, src->fmmixmode);
+	opn.SetVolume(src->volume);
+	opn.SetChannelMask(src->channelmask);
+	Restore(src);
+
+	// 出力は 20ms 遅らせる
+	latency = Min(int(src->currentrate / 50), outputsize - 2 * maxrequest);
+	memset(output, 0, 2 * outputsize * sizeof(int32));
+	jwrite = jread = 0;
+	rwrite = rread = 0;
+	oread = 0;
+	owrite = latency;
+	mixtime = rendertime = time;
+	waited = 0;
+
+	shouldterminate = false;
+	hevent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	hrendered = CreateEvent(NULL, FALSE, FALSE, NULL);
+	hthread = HANDLE(_beginthreadex(NULL, 0, ThreadEntry,
+					   reinterpret_cast<void*> (this), 0, &idthread));
+	if (!hevent || !hrendered || !hthread)
+	{
+		Error::SetError(Error::ThreadInitFailed);
+		return false;
+	}
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+//	後片付
+//
+void OPNPipe::Cleanup()
+{
+	if (hthread)
+	{
+		int i = 300;
+		do
+		{
+			shouldterminate = true;
+			SetEvent(hevent);
+		} while (--i > 0 && WAIT_TIMEOUT == WaitForSingleObject(hthread, 10));
+
+		if (!i)
+			TerminateThread(hthread, 0);
+
+		CloseHandle(hthread), hthread = 0;
+	}
+	if (hevent)
+		CloseHandle(hevent), hevent = 0;
+	if (hrendered)
+		CloseHandle(hrendered), hrendered = 0;
+
+	if (journal)
+		LOG1("waited: %d\n", waited);
+	delete[] journal;	journal = 0;
+	delete[] output;	output = 0;
+}
+
+// ---------------------------------------------------------------------------
+//	レジスタの内容から音源の状態を作る
+//	OPNIF::LoadStatus と同じ順で書き込む．キーオンの状態は復元されない
+//
+void OPNPipe::Restore(OPNIF* src)
+{
+	const uint8* regs = src->regs;
+	bool opna = src->opnamode;
+
+	opn.Reset();
+
+	int i;
+	for (i=0; i<0x10; i++)
+		opn.SetReg(i, regs[i]);
+	for (i=0x11; i<0x28; i++)
+		opn.SetReg(i, regs[i]);
+	opn.SetReg(0x29, regs[0x29]);
+
+	for (i=0x30; i<0xb7; i++)
+	{
+		if ((i & 0xf0) == 0xa0)
+			continue;
+		opn.SetReg(i, regs[i]);
+		if (opna)
+			opn.SetReg(0x100 | i, regs[0x100 | i]);
+	}
+	for (i=0; i<3; i++)
+	{
+		static const uint8 fnum[4] = { 0xa4, 0xa0, 0xac, 0xa8 };
+		for (int j=0; j<4; j++)
+		{
+			uint r = fnum[j] + i;
+			opn.SetReg(r, regs[r]);
+			if (opna)
+				opn.SetReg(0x100 | r, regs[0x100 | r]);
+		}
+	}
+#ifndef USE_OPN
+	if (opna)
+	{
+		for (i=0x100; i<0x10e; i++)
+		{
+			if (i != 0x108)
+				opn.SetReg(i, regs[i]);
+		}
+		memcpy(opn.GetADPCMBuffer(), src->opn.GetADPCMBuffer(), 0x40000);
+	}
+#endif
+}
+
+// ---------------------------------------------------------------------------
+//	音量とチャンネルマスク
+//	合成スレッドと競合するが，値を書き換えるだけなので問題ない
+//
+void OPNPipe::SetVolume(const OPNIF::Volume& volume)
+{
+	opn.SetVolume(volume);
+}
+
+void OPNPipe::SetChannelMask(uint mask)
+{
+	opn.SetChannelMask(mask);
+}
+
+// ---------------------------------------------------------------------------
+//	レジスタへの書き込みを記録する
+//	VM のスレッドから呼ばれる
+//
+void OPNPipe::Write(int time, uint addr, uint data)
+{
+	if (jwrite - jread >= journalsize)
+	{
+		// ジャーナルが一杯．次の Mix で合成スレッドが読み進めるのを待つ
+		waited++;
+		for (int i=0; i<1000 && jwrite - jread >= journalsize; i++)
+			Sleep(1);
+		if (jwrite - jread >= journalsize)
+		{
+			LOG2("journal overflow: %.3x = %.2x\n", addr, data);
+			return;
+		}
+	}
+	Entry& e = journal[jwrite & (journalsize - 1)];
+	e.time = time;
+	e.addr = addr;
+	e.data = data;
+	jwrite = jwrite + 1;
+}
+
+// ---------------------------------------------------------------------------
+//	合成
+//	time までの nsamples サンプル分の合成を要求し，latency サンプル前に
+//	合成した分を dest に加える
+//	Mix は同時に複数のスレッドから呼ばれないこと
+//
+void OPNPipe::Mix(int32* dest, int nsamples, int time)
+{
+	while (nsamples > 0)
+	{
+		// 大きな要求は分け，時刻もサンプル数に比例して分ける
+		int m = Min(nsamples, int(maxrequest));
+		int32 t = mixtime + int32(int64(time - mixtime) * m / nsamples);
+		mixtime = t;
+
+		for (int i=0; i<100 && rwrite - rread >= requestsize; i++)
+			WaitForSingleObject(hrendered, 10);
+		if (rwrite - rread >= requestsize)
+			return;					// 合成スレッドが止まっている
+		Request& r = request[rwrite & (requestsize - 1)];
+		r.time = t;
+		r.samples = m;
+		rwrite = rwrite + 1;
+		SetEvent(hevent);
+
+		// 合成が間に合っていなければ待つ
+		if (owrite - oread < uint(m))
+		{
+			waited++;
+			for (int i=0; i<100 && owrite - oread < uint(m); i++)
+				WaitForSingleObject(hrendered, 10);
+		}
+		int n = Min(m, int(owrite - oread));
+		int p = oread & (outputsize - 1);
+		for (int i=0; i<n; i++)
+		{
+			dest[0] += output[p * 2];
+			dest[1] += output[p * 2 + 1];
+			dest += 2;
+			p = (p + 1) & (outputsize - 1);
+		}
+		oread = oread + n;
+		dest += (m - n) * 2;
+		nsamples -= m;
+	}
+}
+
+// ---------------------------------------------------------------------------
+//	要求 1 つ分の合成
+//	前の要求の時刻から req.time までを req.samples サンプルとして，
+//	その間の書き込みを時刻に応じた位置で反映しながら合成する
+//
+void OPNPipe::Render(const Request& req)
+{
+	int32 buf[2 * maxrequest];
+	int n = req.samples;
+	int32 span = req.time - rendertime;
+	int pos = 0;
+
+	memset(buf, 0, 2 * n * sizeof(int32));
+	while (jread != jwrite)
+	{
+		const Entry& e = journal[jread & (journalsize - 1)];
+		int32 t = e.time - rendertime;
+		if (t > span)
+			break;					// 次の要求の分
+		int at = (t > 0 && span > 0) ? int(int64(t) * n / span) : 0;
+		if (at > pos)
+		{
+			opn.Mix(buf + pos * 2, at - pos);
+			pos = at;
+		}
+		Apply(e);
+		jread = jread + 1;
+	}
+	if (pos < n)
+		opn.Mix(buf + pos * 2, n - pos);
+	rendertime = req.time;
+	Store(buf, n);
+}
+
+// ---------------------------------------------------------------------------
+//	ジャーナルのエントリを音源に反映
+//
+void OPNPipe::Apply(const Entry& e)
+{
+	switch (e.addr)
+	{
+	case cmdreset:
+		opn.Reset();
+		break;
+
+	case cmdcsm:
+		opn.KeyOnCsm();
+		break;
+
+	case cmdread:
+		// ADPCM メモリの読み出しはアドレスを進める
+		opn.GetReg(0x100 | e.data);
+		break;
+
+	default:
+		opn.SetReg(e.addr, e.data);
+		break;
+	}
+}
+
+// ---------------------------------------------------------------------------
+//	合成した音を出力のリングに書く
+//	Mix が一度に要求するのは maxrequest までなので，溢れることはない
+//
+void OPNPipe::Store(int32* src, int n)
+{
+	int p = owrite & (outputsize - 1);
+	int l = Min(n, outputsize - p);
+	memcpy(output + p * 2, src, l * 2 * sizeof(int32));
+	if (l < n)
+		memcpy(output, src + l * 2, (n - l) * 2 * sizeof(int32));
+	owrite = owrite + n;
+}
+
+// ---------------------------------------------------------------------------
+//	合成スレッド
+//
+uint OPNPipe::ThreadMain()
+{
+	while (!shouldterminate)
+	{
+		WaitForSingleObject(hevent, 1000);
+		while (rread != rwrite && !shouldterminate)
+		{
+			Render(request[rread & (requestsize - 1)]);
+			rread = rread + 1;
+			SetEvent(hrendered);
+		}
+	}
+	return 0;
+}
+
+uint __stdcall OPNPipe::ThreadEntry(LPVOID arg)
+{
+	if (arg)
+		return reinterpret_cast<OPNPipe*> (arg)->ThreadMain();
+	else
+		return 0;
+}
@@ -0,0 +1,112 @@
+﻿// ---------------------------------------------------------------------------
+//	M88 - PC-8801 Emulator.
+// ---------------------------------------------------------------------------
+//	OPN/OPNA 合成スレッド
+// ---------------------------------------------------------------------------
+
+#pragma once
+
+#include "types.h"
+#include "pc88/opnif.h"
+
+namespace PC8801
+{
+
+// ---------------------------------------------------------------------------
+//	OPNPipe
+//
+//	OPNIF へのレジスタ書き込みを (時刻, アドレス, データ) のジャーナルに
+//	記録し，別スレッドの複製音源で再生して合成する．
+//	VM 側の音源はタイマーとステータスのためだけに使うので，書き込みの
+//	たびに Sound::Update を呼んで合成を追いつかせる必要がない．
+//
+//	Mix が呼ばれるとサンプル数と時刻を要求として合成スレッドに渡す．
+//	合成スレッドは前の要求の時刻からの経過に応じたサンプル位置で
+//	その時刻までの書き込みを反映しながら合成するので，Mix が呼ばれる
+//	間隔によらず書き込みのタイミングはサンプル単位で再現される．
+//	Mix が返すのは latency サンプル前に合成した音で，合成が間に合って
+//	いれば VM のスレッドは合成を待たない．
+//
+//	ジャーナルと要求はどちらも書き手・読み手が 1 つずつのリングで，
+//	ロックを使わずに受け渡す．
+//
+class OPNPipe
+{
+public:
+	enum
+	{
+		journalsize = 0x10000,		// ジャーナルのエントリ数 (2^n)
+		requestsize = 16,			// 要求のリングの大きさ (2^n)
+		outputsize = 0x4000,		// 出力リングのサンプル数 (2^n)
+		maxrequest = 0x1000,		// 1 回の要求の最大サンプル数
+	};
+	enum Command
+	{
+		cmdreset = 0x200,			// 音源のリセット
+		cmdcsm,						// CSM モードのキーオン
+		cmdread,					// 副作用のあるレジスタの読み出し
+	};
+
+public:
+	OPNPipe();
+	~OPNPipe();
+
+	bool Init(OPNIF* src, int time);
+	void Cleanup();
+
+	void Write(int time, uint addr, uint data);
+	void Mix(int32* dest, int nsamples, int time);
+
+	void SetVolume(const OPNIF::Volume& volume);
+	void SetChannelMask(uint mask);
+
+	uint GetWaitCount() { return waited; }
+
+private:
+	struct Entry
+	{
+		int32 time;
+		uint16 addr;
+		uint8 data;
+	};
+	struct Request
+	{
+		int32 time;
+		int samples;
+	};
+
+	void Restore(OPNIF* src);
+	void Render(const Request& req);
+	void Apply(const Entry& e);
+	void Store(int32* src, int n);
+
+	uint ThreadMain();
+	static uint __stdcall ThreadEntry(LPVOID arg);
+
+	OPNIF::OPNUnit opn;				// 合成用の音源
+
+	Entry* journal;
+	volatile uint jwrite;			// VM が次に書くエントリ (単調増加)
+	volatile uint jread;			// 合成スレッドが次に読むエントリ
+
+	Request request[requestsize];
+	volatile uint rwrite;
+	volatile uint rread;
+
+	int32* output;					// 合成済みのサンプル (ステレオ)
+	volatile uint owrite;
+	volatile uint oread;
+	int latency;					// 出力の遅れ (サンプル)
+
+	int32 mixtime;					// 最後に要求した時刻
+	int32 rendertime;				// 合成スレッドが合成し終えた時刻
+	uint waited;					// 合成を待った回数
+
+	HANDLE hthread;
+	uint idthread;
+	HANDLE hevent;					// 要求があった
+	HANDLE hrendered;				// 合成が進んだ
+	volatile bool shouldterminate;
+};
+
+}
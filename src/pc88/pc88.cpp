@@ -26,6 +26,7 @@
 #include "pc88/tapemgr.h"
 #include "pc88/beep.h"
 #include "pc88/joypad.h"
+#include "pc88/scrnpipe.h"
 #include "calender.h"
 #include "loadmon.h"
 
@@ -44,18 +45,21 @@ PC88::PC88()
   :	cpu1(DEV_ID('C', 'P', 'U', '1')), cpu2(DEV_ID('C', 'P', 'U', '2')),	
 	base(0), mem1(0), dmac(0), 	knj1(0), knj2(0), scrn(0), intc(0), crtc(0), 
 	fdc (0), subsys(0), siotape(0), opn1(0), opn2(0), caln(0), diskmgr(0),
-	beep(0), siomidi(0), joypad(0)
+	beep(0), siomidi(0), joypad(0), scrnpipe(0)
 {
 	assert((1 << MemoryManager::pagebits) <= 0x400); 
 	clock = 100;
 	DIAGINIT(&cpu1);
 	dexc = 0;
+	scrnthread = false;
+	forcerefresh = false;
 }
 
 PC88::~PC88()
 {
 //	devlist.Cleanup();
 
+	delete scrnpipe;
 	delete base;
 	delete mem1;
 	delete dmac;
@@ -183,6 +187,21 @@ void PC88::VSync()
 //
 void PC88::UpdateScreen(bool refresh)
 {
+	if (scrnthread)
+	{
+		forcerefresh = false;
+		scrnpipe->Capture(refresh);
+		return;
+	}
+	if (forcerefresh)
+	{
+		// 合成スレッドが描き終えてから全体を描き直す
+		if (scrnpipe)
+			scrnpipe->Flush();
+		forcerefresh = false;
+		refresh = true;
+	}
+
 	int dstat = draw->GetStatus();
 	if (dstat & Draw::shouldrefresh)
 		refresh = true;
@@ -230,6 +249,30 @@ void PC88::UpdateScreen(bool refresh)
 	}
 }
 
+// ---------------------------------------------------------------------------
+//	前回の UpdateScreen からの画面の変化量を返す
+//	GVRAM の更新ブロック数とテキストの変化した行数から見積もる
+//	0 なら UpdateScreen を省略しても表示は変わらない
+//
+uint PC88::GetScreenChanges()
+{
+	if (updated || forcerefresh || (draw->GetStatus() & Draw::shouldrefresh)
+		|| scrn->IsChanged())
+		return changeall;
+
+	// 合成スレッドが描画できずにいる分を送り出すため
+	uint n = scrnthread && scrnpipe->IsPending() ? 1 : 0;
+	const uint8* dirty = mem1->GetDirtyFlag();
+	const uint32* d = (const uint32*) dirty;
+	for (int i=0; i<0x100; i++)
+	{
+		if (d[i])
+			n += !!dirty[i*4] + !!dirty[i*4+1] + !!dirty[i*4+2] + !!dirty[i*4+3];
+	}
+	n += crtc->GetChangedRows() * changerow;
+	return Min(n, changeall);
+}
+
 // ---------------------------------------------------------------------------
 //	リセット
 //
@@ -313,6 +356,24 @@ bool PC88::ConnectDevices()
 	if (!base->Init(this)) return false;
 	devlist.Add(tapemgr);
 
+	// DMAC よりも先に CRTC に通知する (lazytextdma 用)
+	static const IOBus::Connector c_crtcsync[] =
+	{
+		{ 0x64, IOBus::portout, CRTC::syncout },
+		{ 0x65, IOBus::portout, CRTC::syncout },
+		{ 0x66, IOBus::portout, CRTC::syncout },
+		{ 0x67, IOBus::portout, CRTC::syncout },
+		{ 0x68, IOBus::portout, CRTC::syncout },
+		{ 0x64, IOBus::portin,  CRTC::syncin },
+		{ 0x65, IOBus::portin,  CRTC::syncin },
+		{ 0x66, IOBus::portin,  CRTC::syncin },
+		{ 0x67, IOBus::portin,  CRTC::syncin },
+		{ 0x68, IOBus::portin,  CRTC::syncin },
+		{ 0, 0, 0 }
+	};
+	crtc = new PC8801::CRTC(DEV_ID('C', 'R', 'T', 'C'));
+	if (!crtc || !bus1.Connect(crtc, c_crtcsync)) return false;
+
 	static const IOBus::Connector c_dmac[] =
 	{
 		{ pres, IOBus::portout, PD8257::reset },
@@ -352,8 +413,7 @@ bool PC88::ConnectDevices()
 		{ 0x33,	IOBus::portout, CRTC::setkanamode },
 		{ 0, 0, 0 }
 	};
-	crtc = new PC8801::CRTC(DEV_ID('C', 'R', 'T', 'C'));
-	if (!crtc || !bus1.Connect(crtc, c_crtc)) return false;
+	if (!bus1.Connect(crtc, c_crtc)) return false;
 
 	static const IOBus::Connector c_mem1[] =
 	{
@@ -389,7 +449,7 @@ bool PC88::ConnectDevices()
 	if (!mem1 || !bus1.Connect(mem1, c_mem1)) return false;
 	if (!mem1->Init(&mm1, &bus1, crtc, cpu1.GetWaits())) return false;
 	
-	if (!crtc->Init(&bus1, this, dmac, draw)) return false;
+	if (!crtc->Init(&bus1, this, dmac, draw, &mm1)) return false;
 
 	static const IOBus::Connector c_knj1[] =
 	{
@@ -432,6 +492,7 @@ bool PC88::ConnectDevices()
 		{ 0x59, IOBus::portout, Screen::out55to5b },
 		{ 0x5a, IOBus::portout, Screen::out55to5b },
 		{ 0x5b, IOBus::portout, Screen::out55to5b },
+		{ vrtc, IOBus::portout, Screen::vrtc },
 		{ 0, 0, 0 }
 	};
 	scrn = new PC8801::Screen(DEV_ID('S', 'C', 'R', 'N'));
@@ -649,8 +710,11 @@ void PC88::ApplyConfig(Config* cfg)
 	beep->EnableSING(!(cfg->flags & Config::disablesing));
 	opn1->SetFMMixMode(!!(cfg->flag2 & Config::usefmclock));
 	opn1->SetVolume(cfg);
+	opn1->SetSoundThread(!!(cfg->flag2 & Config::soundthread));
 	opn2->SetFMMixMode(!!(cfg->flag2 & Config::usefmclock));
 	opn2->SetVolume(cfg);
+	opn2->SetSoundThread(!!(cfg->flag2 & Config::soundthread));
+	ApplyScreenPipe(cfg);
 	
 	cpumode = (cfg->cpumode == Config::msauto)
 		? (cfg->mainsubratio > 1 ? ms21 : ms11)
@@ -674,6 +738,49 @@ void PC88::ApplyConfig(Config* cfg)
 
 }
 
+// ---------------------------------------------------------------------------
+//	画面合成スレッドの設定
+//	一度作った ScreenPipe は VM のスレッドと競合しないよう
+//	ReleaseScreenPipe までは破棄しない
+//
+void PC88::ApplyScreenPipe(Config* cfg)
+{
+	bool enable = (cfg->flag2 & Config::screenthread) != 0;
+	if (enable && !scrnpipe)
+	{
+		ScreenPipe* sp = new ScreenPipe;
+		if (sp && sp->Init(mem1, crtc, scrn, draw))
+			scrnpipe = sp;
+		else
+			delete sp;
+	}
+	if (scrnpipe)
+	{
+		scrnpipe->ApplyConfig(cfg);
+		if (enable && !scrnthread)
+		{
+			scrnpipe->Resync();
+			forcerefresh = true;
+		}
+	}
+	if (!enable && scrnthread)
+		forcerefresh = true;
+	scrnthread = enable && scrnpipe != 0;
+}
+
+// ---------------------------------------------------------------------------
+//	画面合成スレッドを停止する
+//	Draw を破棄する前に呼ぶこと
+//
+void PC88::ReleaseScreenPipe()
+{
+	if (scrnthread)
+		forcerefresh = true;
+	scrnthread = false;
+	delete scrnpipe;
+	scrnpipe = 0;
+}
+
 // ---------------------------------------------------------------------------
 //	音量変更
 //
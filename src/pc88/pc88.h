@@ -60,6 +60,7 @@ namespace PC8801
 	class DiskIO;
 	class Beep;
 	class JoyPad;
+	class ScreenPipe;
 }
 
 // ---------------------------------------------------------------------------
@@ -96,6 +97,8 @@ public:
 	void TimeSync();
 	
 	void UpdateScreen(bool refresh = false);
+	uint GetScreenChanges();
+	void ReleaseScreenPipe();
 	bool IsCDSupported();
 	bool IsN80Supported();
 	bool IsN80V2Supported();
@@ -115,6 +118,11 @@ public:
 	int  GetFramePeriod();
 
 public:
+	enum
+	{
+		changeall = 0x800,		// GetScreenChanges: 全体を書き直す
+		changerow = 40,			// GetScreenChanges: テキスト 1 行分
+	};
 	enum SpecialPort
 	{
 		pint0 = 0x100, 
@@ -147,6 +155,7 @@ private:
 	bool ConnectDevices();
 	bool ConnectDevices2();
 	int GetTicks();
+	void ApplyScreenPipe(PC8801::Config* cfg);
 			
 private:
 	enum CPUMode
@@ -165,6 +174,8 @@ private:
 	uint cfgflags;
 	uint cfgflag2;
 	bool updated;
+	bool scrnthread;		// 画面合成を別スレッドで行う
+	bool forcerefresh;		// 次の画面更新で全体を書き直す
 	
 	PC8801::Memory* mem1;
 	PC8801::KanjiROM* knj1;
@@ -182,6 +193,7 @@ private:
 	PC8801::Calender* caln;
 	PC8801::Beep* beep;
 	PC8801::PD8257* dmac;
+	PC8801::ScreenPipe* scrnpipe;
 	
 protected:
 	Draw* draw;
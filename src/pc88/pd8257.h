@@ -45,6 +45,9 @@ public:
 	
 	uint IFCALL RequestRead(uint bank, uint8* data, uint nbytes);
 	uint IFCALL RequestWrite(uint bank, uint8* data, uint nbytes);
+
+	uint GetPtr(uint bank) { return stat.ptr[bank]; }
+	bool IsAutoInit() { return stat.autoinit; }
 	
 	uint IFCALL GetStatusSize();
 	bool IFCALL SaveStatus(uint8* status);
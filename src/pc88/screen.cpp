@@ -12,6 +12,7 @@
 #include "pc88/config.h"
 #include "pc88/crtc.h"
 #include "status.h"
+#include "loadmon.h"
 
 #define LOGNAME	"screen"
 #include "diag.h"
@@ -67,9 +68,15 @@ const uint8 Screen::palextable[2][8] =
 Screen::Screen(const ID& id)
 : Device(id)
 {
-	CreateTable();
 	line400 = false;
 	line320 = false;
+	gvram = 0;
+	dirtyflag = 0;
+	rasterlog.nbands = 0;
+	rasterdraw.nbands = 0;
+	logtop = 0;
+	rastered = false;
+	rasterpal = false;
 }
 
 Screen::~Screen()
@@ -84,6 +91,8 @@ bool Screen::Init(IOBus* _bus, Memory* mem, CRTC* _crtc)
 	bus = _bus;
 	memory = mem;
 	crtc = _crtc;
+	if (memory)
+		SetSource(memory->GetGVRAM(), memory->GetDirtyFlag());
 
 	palettechanged = true;
 	modechanged = true;
@@ -114,6 +123,9 @@ void IOCALL Screen::Reset(uint,uint)
 	port31 = ~port31;
 	Out31(0x31, ~port31);
 	modechanged = true;
+	rasterlog.nbands = 0;
+	rasterdraw.nbands = 0;
+	logtop = 0;
 }
 
 static inline Draw::Palette Avg(Draw::Palette a, Draw::Palette b)
@@ -129,6 +141,40 @@ static inline Draw::Palette Avg(Draw::Palette a, Draw::Palette b)
 //	パレットを更新
 //
 bool Screen::UpdatePalette(Draw* draw)
+{
+	if (rasterdraw.nbands > 1)
+		return UpdateRasterPalette(draw);
+	if (rasterpal)
+	{
+		// 帯ごとのパレットをやめる
+		rasterpal = false;
+		draw->SetRasterPalette(0, 0, 0x40, 0x90, 0);
+		palettechanged = true;
+	}
+
+	int pmode = GetPMode();
+	if (pmode != prevpmode || modechanged)
+	{
+		LOG1("p:%.2x ", pmode);
+		palettechanged = true;
+		prevpmode = pmode;
+	}
+
+	if (palettechanged)
+	{
+		palettechanged = false;
+		Draw::Palette palette[0x90];
+		MakePalette(palette);
+		draw->SetPalette(0x40, 0x90, palette);
+		return true;
+	}
+	return false;
+}
+
+// ---------------------------------------------------------------------------
+//	パレットの選び方に関わるモード
+//
+int Screen::GetPMode()
 {
 	int pmode;
 	
@@ -151,175 +197,194 @@ bool Screen::UpdatePalette(Draw* draw)
 			pmode |= (port53 & (line320 ? 6 : 2)) << 1;
 	}
 //	statusdisplay.Show(10, 0, "SCRN: %.3x", pmode);
+	return pmode;
+}
 
-	if (pmode != prevpmode || modechanged)
+// ---------------------------------------------------------------------------
+//	現在の状態からパレット (0x40-0xcf) を作成
+//
+void Screen::MakePalette(Draw::Palette* palette)
+{
+	// palette parameter is
+	//	palette
+	//	-textcolor(port30 & 2)
+	//	-displaygraphics
+	//	port32 & 0x20
+	//	-port53 & 1
+	//	^port53 & 6 (if not color)
+
+	Draw::Palette xpal[10];
+	if (!texttp)
 	{
-		LOG1("p:%.2x ", pmode);
-		palettechanged = true;
-		prevpmode = pmode;
+		for (int i=0; i<8; i++)
+		{
+			xpal[i].red   = pex[pal[i].red];
+			xpal[i].green = pex[pal[i].green];
+			xpal[i].blue  = pex[pal[i].blue];
+		}
 	}
-
-	if (palettechanged)
+	else
 	{
-		palettechanged = false;
-		// palette parameter is
-		//	palette
-		//	-textcolor(port30 & 2)
-		//	-displaygraphics
-		//	port32 & 0x20
-		//	-port53 & 1
-		//	^port53 & 6 (if not color)
-
-		Draw::Palette xpal[10];
-		if (!texttp)
+		for (int i=0; i<8; i++)
+		{
+			xpal[i].red   = (pex[pal[i].red]   * 3 + ((i << 7) & 0x100)) / 4;
+			xpal[i].green = (pex[pal[i].green] * 3 + ((i << 6) & 0x100)) / 4;
+			xpal[i].blue  = (pex[pal[i].blue]  * 3 + ((i << 8) & 0x100)) / 4;
+		}
+	}
+	if (gmask)
+	{
+		for (int i=0; i<8; i++)
 		{
-			for (int i=0; i<8; i++)
+			if (i & ~gmask)
+			{
+				xpal[i].green = (xpal[i].green / 8) + 0xe0;
+				xpal[i].red   = (xpal[i].red   / 8) + 0xe0;
+				xpal[i].blue  = (xpal[i].blue  / 8) + 0xe0;
+			}
+			else
 			{
-				xpal[i].red   = pex[pal[i].red];
-				xpal[i].green = pex[pal[i].green];
-				xpal[i].blue  = pex[pal[i].blue];
+				xpal[i].green = (xpal[i].green / 6) + 0;
+				xpal[i].red   = (xpal[i].red   / 6) + 0;
+				xpal[i].blue  = (xpal[i].blue  / 6) + 0;
 			}
 		}
-		else
+	}
+
+	xpal[8].red = xpal[8].green = xpal[8].blue = 0;
+	xpal[9].red   = pex[bgpal.red];
+	xpal[9].green = pex[bgpal.green];
+	xpal[9].blue  = pex[bgpal.blue];
+	
+	Draw::Palette* p = palette;
+
+	int textcolor = port30 & 2 ? 7 : 0;
+
+	if (color)
+	{
+		LOG2("\ncolor  port53 = %.2x  port32 = %.2x\n", port53, port32);
+		//	color mode		GG GG GR GB TE TG TR TB	
+		if (port53 & 1)		// hide text plane ?
 		{
-			for (int i=0; i<8; i++)
+			for (int gc=0; gc<9; gc++)
 			{
-				xpal[i].red   = (pex[pal[i].red]   * 3 + ((i << 7) & 0x100)) / 4;
-				xpal[i].green = (pex[pal[i].green] * 3 + ((i << 6) & 0x100)) / 4;
-				xpal[i].blue  = (pex[pal[i].blue]  * 3 + ((i << 8) & 0x100)) / 4;
+				Draw::Palette c = displaygraphics || texttp ? xpal[gc] : xpal[8];
+
+				for (int i=0; i<16; i++)
+					*p++ = c;
 			}
 		}
-		if (gmask)
+		else
 		{
-			for (int i=0; i<8; i++)
+			for (int gc=0; gc<9; gc++)
 			{
-				if (i & ~gmask)
+				Draw::Palette c = displaygraphics || texttp ? xpal[gc] : xpal[8];
+				
+				for (int i=0; i<8; i++)
+					*p++ = c;
+				if (textpriority && gc > 0)
 				{
-					xpal[i].green = (xpal[i].green / 8) + 0xe0;
-					xpal[i].red   = (xpal[i].red   / 8) + 0xe0;
-					xpal[i].blue  = (xpal[i].blue  / 8) + 0xe0;
+					for (int tc=0; tc<8; tc++)
+						*p++ = c;
+				}
+				else if (texttp)
+				{
+					for (int tc=0; tc<8; tc++)
+						*p++ = Avg(c, palcolor[tc]);
 				}
 				else
 				{
-					xpal[i].green = (xpal[i].green / 6) + 0;
-					xpal[i].red   = (xpal[i].red   / 6) + 0;
-					xpal[i].blue  = (xpal[i].blue  / 6) + 0;
+					*p++ = palcolor[0]; 
+					for (int tc=1; tc<8; tc++)
+						*p++ = palcolor[tc | textcolor];
 				}
 			}
+
+			if (fv15k)
+			{
+				for (int i=0x80; i<0x90; i++)
+					palette[i] = palcolor[0];
+			}
 		}
+	}
+	else
+	{
+		//	b/w mode	0  1  G  RE TE   TG TB TR
 
-		xpal[8].red = xpal[8].green = xpal[8].blue = 0;
-		xpal[9].red   = pex[bgpal.red];
-		xpal[9].green = pex[bgpal.green];
-		xpal[9].blue  = pex[bgpal.blue];
+		const Draw::Palette* tpal = port32 & 0x20 ? xpal : palcolor;
 		
-		Draw::Palette palette[0x90];
-		Draw::Palette* p = palette;
-
-		int textcolor = port30 & 2 ? 7 : 0;
-
-		if (color)
+		LOG3("\nb/w  port53 = %.2x  port32 = %.2x  port30 = %.2x\n", port53, port32, port30);
+		if (port53 & 1)		// hidetext
 		{
-			LOG2("\ncolor  port53 = %.2x  port32 = %.2x\n", port53, port32);
-			//	color mode		GG GG GR GB TE TG TR TB	
-			if (port53 & 1)		// hide text plane ?
-			{
-				for (int gc=0; gc<9; gc++)
-				{
-					Draw::Palette c = displaygraphics || texttp ? xpal[gc] : xpal[8];
-
-					for (int i=0; i<16; i++)
-						*p++ = c;
-				}
-			}
-			else
+			int m = texttp || displaygraphics ? ~0 : ~1;
+			for (int gc=0; gc<4; gc++)
 			{
-				for (int gc=0; gc<9; gc++)
+				int x = gc & m;
+				if (((~x>>1) & x & 1))
 				{
-					Draw::Palette c = displaygraphics || texttp ? xpal[gc] : xpal[8];
-					
-					for (int i=0; i<8; i++)
-						*p++ = c;
-					if (textpriority && gc > 0)
-					{
-						for (int tc=0; tc<8; tc++)
-							*p++ = c;
-					}
-					else if (texttp)
-					{
-						for (int tc=0; tc<8; tc++)
-							*p++ = Avg(c, palcolor[tc]);
-					}
-					else
-					{
-						*p++ = palcolor[0]; 
-						for (int tc=1; tc<8; tc++)
-							*p++ = palcolor[tc | textcolor];
-					}
+					for (int i=0; i<32; i++)
+						*p++ = tpal[(i&7) | textcolor];
 				}
-
-				if (fv15k)
+				else
 				{
-					for (int i=0x80; i<0x90; i++)
-						palette[i] = palcolor[0];
+					for (int i=0; i<32; i++)
+						*p++ = xpal[9];
 				}
 			}
 		}
 		else
 		{
-			//	b/w mode	0  1  G  RE TE   TG TB TR
-
-			const Draw::Palette* tpal = port32 & 0x20 ? xpal : palcolor;
-			
-			LOG3("\nb/w  port53 = %.2x  port32 = %.2x  port30 = %.2x\n", port53, port32, port30);
-			if (port53 & 1)		// hidetext
+			int m = texttp || displaygraphics ? ~0 : ~4;
+			for (int gc=0; gc<16; gc++)
 			{
-				int m = texttp || displaygraphics ? ~0 : ~1;
-				for (int gc=0; gc<4; gc++)
+				int x = gc & m;
+				if (((((~x>>3) & (x>>2)) | x) ^ (x>>1)) & 1)
 				{
-					int x = gc & m;
-					if (((~x>>1) & x & 1))
-					{
-						for (int i=0; i<32; i++)
-							*p++ = tpal[(i&7) | textcolor];
-					}
+					if ((x & 8) && fv15k)
+						for (int i=0; i<8; i++)
+							*p++ = xpal[8];
 					else
-					{
-						for (int i=0; i<32; i++)
-							*p++ = xpal[9];
-					}
+						for (int i=0; i<8; i++)
+							*p++ = tpal[i | textcolor];
 				}
-			}
-			else
-			{
-				int m = texttp || displaygraphics ? ~0 : ~4;
-				for (int gc=0; gc<16; gc++)
+				else
 				{
-					int x = gc & m;
-					if (((((~x>>3) & (x>>2)) | x) ^ (x>>1)) & 1)
-					{
-						if ((x & 8) && fv15k)
-							for (int i=0; i<8; i++)
-								*p++ = xpal[8];
-						else
-							for (int i=0; i<8; i++)
-								*p++ = tpal[i | textcolor];
-					}
-					else
-					{
-						for (int i=0; i<8; i++)
-							*p++ = xpal[9];
-					}
+					for (int i=0; i<8; i++)
+						*p++ = xpal[9];
 				}
 			}
 		}
+	}
 
 //		for (int gc=0; gc<0x90; gc++)
 //			LOG4("P[%.2x] = %.2x %.2x %.2x\n", gc, palette[gc].green, palette[gc].red, palette[gc].blue);
-		draw->SetPalette(0x40, 0x90, palette);
-		return true;
+}
+
+// ---------------------------------------------------------------------------
+//	帯ごとのパレットを設定
+//
+bool Screen::UpdateRasterPalette(Draw* draw)
+{
+	const RasterLog& log = rasterdraw;
+	Draw::Palette palette[maxbands * 0x90];
+	int top[maxbands];
+
+	Frame current;
+	GetState(&current);
+	for (int i=0; i<log.nbands; i++)
+	{
+		SetState(&log.band[i].state);
+		top[i] = log.band[i].top;
+		MakePalette(palette + i * 0x90);
 	}
-	return false;
+	SetState(&current);
+	rasterpal = draw->SetRasterPalette(log.nbands, top, 0x40, 0x90, palette);
+
+	// 帯ごとのパレットに対応していない場合は現在のパレットで表示される
+	MakePalette(palette);
+	draw->SetPalette(0x40, 0x90, palette);
+	palettechanged = false;
+	return true;
 }
 
 // ---------------------------------------------------------------------------
@@ -327,6 +392,46 @@ bool Screen::UpdatePalette(Draw* draw)
 //	arg:	region		更新領域
 //
 void Screen::UpdateScreen(uint8* image, int bpl, Draw::Region& region, bool refresh)
+{
+	if (rasterdraw.nbands > 1)
+	{
+		LOADBEGIN("Screen.Raster");
+		UpdateScreenRaster(image, bpl, region);
+		LOADEND("Screen.Raster");
+		return;
+	}
+	if (rastered)
+	{
+		// 帯ごとの合成から戻ったので全体を書き直す
+		rastered = false;
+		refresh = true;
+	}
+
+	int gmode = GetGMode();
+	if (gmode != prevgmode)
+	{
+		LOG1("g:%.2x ", gmode);
+		prevgmode = gmode;
+		modechanged = true;
+	}
+	
+	if (modechanged || refresh)
+	{
+		LOG0("<modechange> ");
+		modechanged = false;
+		palettechanged = true;
+		ClearScreen(image, bpl);
+		memset(dirtyflag, 1, 0x400);
+	}
+	UpdateFunc func = GetUpdateFunc(gmode);
+	if (func)
+		(this->*func)(image, bpl, region);
+}
+
+// ---------------------------------------------------------------------------
+//	画面モードの取得
+//
+int Screen::GetGMode()
 {
 	// 53 53 53 GR TX  80 V2 32 CL  53 53 53 L4 (b4～b6の配置は変えないこと)
 	int gmode = line400 ? 1 : 0;
@@ -343,47 +448,94 @@ void Screen::UpdateScreen(uint8* image, int bpl, Draw::Region& region, bool refr
 		else if (line320)
 			gmode |= (port53 & 0x70) << 6;
 	}
+	return gmode;
+}
 
-	if (gmode != prevgmode)
+// ---------------------------------------------------------------------------
+//	画面モードに対応する合成関数
+//
+Screen::UpdateFunc Screen::GetUpdateFunc(int gmode)
+{
+	if (!n80mode)
 	{
-		LOG1("g:%.2x ", gmode);
-		prevgmode = gmode;
-		modechanged = true;
+		if (color)
+			return &Screen::UpdateScreen200c;
+		return line400 ? &Screen::UpdateScreen400b : &Screen::UpdateScreen200b;
 	}
-	
-	if (modechanged || refresh)
+	switch((gmode>>4) & 7) {
+	case 0:	return &Screen::UpdateScreen80b;	//	V1 640x200 B&W
+	case 1:	return &Screen::UpdateScreen200c;	//	V1 640x200 COLOR
+	case 2:	return 0;							//	V1 320x200 は常にCOLORなのでB&Wは存在しない
+	case 3:	return &Screen::UpdateScreen80c;	//	V1 320x200 COLOR
+	case 4:	return &Screen::UpdateScreen200b;	//	V2 640x200 B&W
+	case 5:	return &Screen::UpdateScreen200c;	//	V2 640x200 COLOR
+	case 6:	return &Screen::UpdateScreen320b;	//	V2 320x200 B&W
+	case 7:	return &Screen::UpdateScreen320c;	//	V2 320x200 COLOR
+	}
+	return 0;
+}
+
+// ---------------------------------------------------------------------------
+//	帯ごとの画面合成
+//	各帯の状態に切り替えて，帯に含まれるラインだけを合成する．
+//	400 ライン時は 1 ブロックが上下 2 ラインにまたがるため，
+//	すべての帯を消去してから合成する
+//
+void Screen::UpdateScreenRaster(uint8* image, int bpl, Draw::Region& region)
+{
+	const RasterLog& log = rasterdraw;
+	Frame current;
+	GetState(&current);
+
+	int i;
+	for (i=0; i<log.nbands; i++)
 	{
-		LOG0("<modechange> ");
-		modechanged = false;
-		palettechanged = true;
-		ClearScreen(image, bpl);
-		memset(memory->GetDirtyFlag(), 1, 0x400);
+		int bottom = i+1 < log.nbands ? log.band[i+1].top : 400;
+		SetState(&log.band[i].state);
+		ClearScreen(image, bpl, log.band[i].top, bottom);
 	}
-	if (!n80mode)
+	for (i=0; i<log.nbands; i++)
 	{
-		if (color)
-			UpdateScreen200c(image, bpl, region);
-		else
+		int bottom = i+1 < log.nbands ? log.band[i+1].top : 400;
+		SetState(&log.band[i].state);
+		UpdateFunc func = GetUpdateFunc(GetGMode());
+		if (func)
 		{
-			if (line400)
-				UpdateScreen400b(image, bpl, region);
-			else
-				UpdateScreen200b(image, bpl, region);
+			MarkBand(func, log.band[i].top, bottom);
+			(this->*func)(image, bpl, region);
 		}
 	}
-	else
+	SetState(&current);
+
+	// 毎回全体を合成するので更新フラグは不要
+	memset(dirtyflag, 0, 0x400);
+	rastered = true;
+	region.Update(0, 399);
+}
+
+// ---------------------------------------------------------------------------
+//	帯に含まれるブロックの更新フラグを立てる
+//	ブロックの先頭ラインが含まれる帯で合成する
+//	(400 ライン時の下半分は上半分と同じ帯になる)
+//
+void Screen::MarkBand(UpdateFunc func, int top, int bottom)
+{
+	memset(dirtyflag, 0, 0x400);
+	if (func == &Screen::UpdateScreen320c || func == &Screen::UpdateScreen320b)
 	{
-		switch((gmode>>4) & 7) {
-		case 0:	UpdateScreen80b(image, bpl, region);  break; //	V1 640x200 B&W
-		case 1:	UpdateScreen200c(image, bpl, region); break; //	V1 640x200 COLOR
-		case 2:										  break; //	V1 320x200 は常にCOLORなのでB&Wは存在しない
-		case 3:	UpdateScreen80c(image, bpl, region);  break; //	V1 320x200 COLOR
-		case 4:	UpdateScreen200b(image, bpl, region); break; //	V2 640x200 B&W
-		case 5:	UpdateScreen200c(image, bpl, region); break; //	V2 640x200 COLOR
-		case 6:	UpdateScreen320b(image, bpl, region); break; //	V2 320x200 B&W
-		case 7:	UpdateScreen320c(image, bpl, region); break; //	V2 320x200 COLOR
+		// 1 ブロック行 = 4 ライン，2 画面分
+		for (int y=(top+3)/4; y<Min(100, (bottom+3)/4); y++)
+		{
+			memset(dirtyflag + y * 5, 1, 5);
+			memset(dirtyflag + 0x200 + y * 5, 1, 5);
 		}
 	}
+	else
+	{
+		int s = func == &Screen::UpdateScreen400b ? 0 : 1;
+		for (int y=(top+s)>>s; y<Min(200, (bottom+s)>>s); y++)
+			memset(dirtyflag + y * 5, 1, 5);
+	}
 }
 
 
@@ -405,7 +557,7 @@ void Screen::UpdateScreen(uint8* image, int bpl, Draw::Region& region, bool refr
 // 640x200, 3 plane color
 void Screen::UpdateScreen200c(uint8* image, int bpl, Draw::Region& region)
 {
-	uint8* dirty = memory->GetDirtyFlag();
+	uint8* dirty = dirtyflag;
 	int y;
 	for (y=0; y<1000; y+=sizeof(packed))
 	{
@@ -421,7 +573,7 @@ void Screen::UpdateScreen200c(uint8* image, int bpl, Draw::Region& region)
 		image += 2 * bpl * y;
 		dirty += 5 * y;
 
-		Memory::quadbyte* src = memory->GetGVRAM() + y * 80;
+		Memory::quadbyte* src = gvram + y * 80;
 		int dm = 0;
 
 		if (!fullline)
@@ -502,7 +654,7 @@ void Screen::UpdateScreen200c(uint8* image, int bpl, Draw::Region& region)
 // 640x200, b/w
 void Screen::UpdateScreen200b(uint8* image, int bpl, Draw::Region& region)
 {
-	uint8* dirty = memory->GetDirtyFlag();
+	uint8* dirty = dirtyflag;
 	int y;
 	for (y=0; y<1000; y+=sizeof(packed))
 	{
@@ -518,7 +670,7 @@ void Screen::UpdateScreen200b(uint8* image, int bpl, Draw::Region& region)
 		image += 2 * bpl * y;
 		dirty += 5 * y;
 
-		Memory::quadbyte* src = memory->GetGVRAM() + y * 80;
+		Memory::quadbyte* src = gvram + y * 80;
 
 		Memory::quadbyte mask;
 		mask.byte[0] = port53 & 2 ? 0x00 : 0xff;
@@ -597,7 +749,7 @@ void Screen::UpdateScreen200b(uint8* image, int bpl, Draw::Region& region)
 
 void Screen::UpdateScreen400b(uint8* image, int bpl, Draw::Region& region)
 {
-	uint8* dirty = memory->GetDirtyFlag();
+	uint8* dirty = dirtyflag;
 	int y;
 	for (y=0; y<1000; y+=sizeof(packed))
 	{
@@ -613,7 +765,7 @@ void Screen::UpdateScreen400b(uint8* image, int bpl, Draw::Region& region)
 		image += bpl * y;
 		dirty += 5 * y;
 
-		Memory::quadbyte* src = memory->GetGVRAM() + y * 80;
+		Memory::quadbyte* src = gvram + y * 80;
 
 		Memory::quadbyte mask;
 		mask.byte[0] = port53 & 2 ? 0x00 : 0xff;
@@ -668,7 +820,7 @@ void Screen::UpdateScreen400b(uint8* image, int bpl, Draw::Region& region)
 // 320x200, color?
 void Screen::UpdateScreen80c(uint8* image, int bpl, Draw::Region& region)
 {
-	uint8* dirty = memory->GetDirtyFlag();
+	uint8* dirty = dirtyflag;
 	int y;
 	for (y=0; y<1000; y+=sizeof(packed))
 	{
@@ -684,7 +836,7 @@ void Screen::UpdateScreen80c(uint8* image, int bpl, Draw::Region& region)
 		image += 2 * bpl * y;
 		dirty += 5 * y;
 
-		Memory::quadbyte* src = memory->GetGVRAM() + y * 80;
+		Memory::quadbyte* src = gvram + y * 80;
 		int dm = 0;
 		
 		if (!fullline)
@@ -763,7 +915,7 @@ void Screen::UpdateScreen80c(uint8* image, int bpl, Draw::Region& region)
 
 void Screen::UpdateScreen80b(uint8* image, int bpl, Draw::Region& region)
 {
-	uint8* dirty = memory->GetDirtyFlag();
+	uint8* dirty = dirtyflag;
 	int y;
 	for (y=0; y<1000; y+=sizeof(packed))
 	{
@@ -779,7 +931,7 @@ void Screen::UpdateScreen80b(uint8* image, int bpl, Draw::Region& region)
 		image += 2 * bpl * y;
 		dirty += 5 * y;
 
-		Memory::quadbyte* src = memory->GetGVRAM() + y * 80;
+		Memory::quadbyte* src = gvram + y * 80;
 
 		Memory::quadbyte mask;
 		if (!gmask)
@@ -871,7 +1023,7 @@ void Screen::UpdateScreen80b(uint8* image, int bpl, Draw::Region& region)
 							| (E80SRTable[(bp2 & 0x03) | (rp2 & 0x0c) | (gp2 & 0x30)] & ~m);
 void Screen::UpdateScreen320c(uint8* image, int bpl, Draw::Region& region)
 {
-	uint8* dirty1 = memory->GetDirtyFlag();
+	uint8* dirty1 = dirtyflag;
 	uint8* dirty2 = dirty1 + 0x200;
 	int y;
 	for (y=0; y<500; y+=sizeof(packed))
@@ -894,14 +1046,14 @@ void Screen::UpdateScreen320c(uint8* image, int bpl, Draw::Region& region)
 		uint dspoff;
 		if (!grphpriority)
 		{
-			src1 = memory->GetGVRAM() + y * 80;
-			src2 = memory->GetGVRAM() + y * 80 + 0x2000;
+			src1 = gvram + y * 80;
+			src2 = gvram + y * 80 + 0x2000;
 			dspoff = port53;
 		}
 		else
 		{
-			src1 = memory->GetGVRAM() + y * 80 + 0x2000;
-			src2 = memory->GetGVRAM() + y * 80;
+			src1 = gvram + y * 80 + 0x2000;
+			src2 = gvram + y * 80;
 			dspoff = ((port53 >> 1) & 2) | ((port53 << 1) & 4);
 		}
 		int dm = 0;
@@ -1031,7 +1183,7 @@ void Screen::UpdateScreen320c(uint8* image, int bpl, Draw::Region& region)
 
 void Screen::UpdateScreen320b(uint8* image, int bpl, Draw::Region& region)
 {
-	uint8* dirty1 = memory->GetDirtyFlag();
+	uint8* dirty1 = dirtyflag;
 	uint8* dirty2 = dirty1 + 0x200;
 	int y;
 	for (y=0; y<500; y+=sizeof(packed))
@@ -1049,7 +1201,7 @@ void Screen::UpdateScreen320b(uint8* image, int bpl, Draw::Region& region)
 		dirty1 += 5 * y;
 		dirty2 += 5 * y;
 
-		Memory::quadbyte* src = memory->GetGVRAM() + y * 80;
+		Memory::quadbyte* src = gvram + y * 80;
 
 		Memory::quadbyte mask1;
 		Memory::quadbyte mask2;
@@ -1149,12 +1301,63 @@ void Screen::UpdateScreen320b(uint8* image, int bpl, Draw::Region& region)
 	}
 }
 
+// ---------------------------------------------------------------------------
+//	表示期間中のレジスタ書き込みを記録する
+//	書き込み前の状態を直前の帯として残す
+//
+void Screen::LogWrite()
+{
+	int y = crtc->GetRasterLine();
+	if (y > logtop)
+	{
+		AppendBand(logtop);
+		logtop = y;
+	}
+}
+
+void Screen::AppendBand(int top)
+{
+	RasterLog& log = rasterlog;
+	if (log.nbands >= maxbands)
+	{
+		// 入りきらない変化は最後の帯にまとめる
+		GetState(&log.band[maxbands-1].state);
+		return;
+	}
+	Band& band = log.band[log.nbands];
+	GetState(&band.state);
+	if (log.nbands > 0 && !memcmp(&band.state, &log.band[log.nbands-1].state, sizeof(Frame)))
+		return;
+	band.top = top;
+	log.nbands++;
+}
+
+// ---------------------------------------------------------------------------
+//	VRTC
+//	表示期間の終わりに記録を締めくくり，2 つ以上の帯があれば合成に使う
+//
+void IOCALL Screen::VRTC(uint, uint en)
+{
+	if (en)
+	{
+		if (rasterlog.nbands)
+			AppendBand(logtop);
+		if (rasterlog.nbands > 1)
+			rasterdraw = rasterlog;
+		else
+			rasterdraw.nbands = 0;
+	}
+	rasterlog.nbands = 0;
+	logtop = 0;
+}
+
 // ---------------------------------------------------------------------------
 //	Out 30
 //	b1	CRT モードコントロール
 //
 void IOCALL Screen::Out30(uint, uint data)
 {
+	LogWrite();
 //	uint i = port30 ^ data;
 	port30 = data;
 	crtc->SetTextSize(!(data & 0x01));
@@ -1168,6 +1371,7 @@ void IOCALL Screen::Out30(uint, uint data)
 //	
 void IOCALL Screen::Out31(uint, uint data)
 {
+	LogWrite();
 	int i = port31 ^ data;
 	
 	if (!n80mode)
@@ -1264,6 +1468,7 @@ void IOCALL Screen::Out31(uint, uint data)
 //	
 void IOCALL Screen::Out32(uint, uint data)
 {
+	LogWrite();
 	uint i = port32 ^ data;
 	if (i & 0x20)
 	{
@@ -1281,6 +1486,7 @@ void IOCALL Screen::Out32(uint, uint data)
 //
 void IOCALL Screen::Out33(uint, uint data)
 {
+	LogWrite();
 	if (n80mode) 
 	{
 		uint i = port33 ^ data;
@@ -1300,6 +1506,7 @@ void IOCALL Screen::Out33(uint, uint data)
 //
 void IOCALL Screen::Out52(uint, uint data)
 {
+	LogWrite();
 	if (!(port32 & 0x20))
 	{
 		bgpal.blue  = (data & 0x08) ? 255 : 0;
@@ -1317,6 +1524,7 @@ void IOCALL Screen::Out52(uint, uint data)
 //	
 void IOCALL Screen::Out53(uint, uint data)
 {
+	LogWrite();
 	if (!n80mode) 
 	{
 		LOG4("show plane(53) : %c%c%c %c\n",
@@ -1366,6 +1574,7 @@ void IOCALL Screen::Out53(uint, uint data)
 //
 void IOCALL Screen::Out54(uint, uint data)
 { 
+	LogWrite();
 	if (port32 & 0x20)		// is analog palette mode ? 
 	{
 		Pal& p = data & 0x80 ? bgpal : pal[0];
@@ -1394,6 +1603,7 @@ void IOCALL Screen::Out54(uint, uint data)
 //	
 void IOCALL Screen::Out55to5b(uint port, uint data)
 {
+	LogWrite();
 	Pal& p = pal[port - 0x54];
 	
 	if (!n80mode && (port32 & 0x20))		// is analog palette mode?
@@ -1418,13 +1628,14 @@ void IOCALL Screen::Out55to5b(uint port, uint data)
 // ---------------------------------------------------------------------------
 //	画面消去
 //
-void Screen::ClearScreen(uint8* image, int bpl)
+void Screen::ClearScreen(uint8* image, int bpl, int top, int bottom)
 {
 	// COLOR
 	
 	if (color)
 	{
-		for (int y=0; y<400; y++, image+=bpl)
+		image += top * bpl;
+		for (int y=top; y<bottom; y++, image+=bpl)
 		{
 			packed* ptr = (packed*) image;
 
@@ -1441,8 +1652,10 @@ void Screen::ClearScreen(uint8* image, int bpl)
 	{
 		bool maskeven = !line400 || n80mode;
 		int d = maskeven ? 2 * bpl : bpl;
+		int s = maskeven ? 1 : 0;
 		
-		for (int y=(maskeven ? 200 : 400); y>0; y--, image+=d)
+		image += (top >> s) * d;
+		for (int y=((bottom+s)>>s)-(top>>s); y>0; y--, image+=d)
 		{
 			int v;
 			packed* ptr = (packed*) image;
@@ -1488,16 +1701,116 @@ void Screen::ApplyConfig(const Config* config)
 }
 
 // ---------------------------------------------------------------------------
-//	Table 作成
+//	合成に使う GVRAM と更新フラグを指定する
+//
+void Screen::SetSource(Memory::quadbyte* gv, uint8* dirty)
+{
+	gvram = gv;
+	dirtyflag = dirty;
+}
+
+// ---------------------------------------------------------------------------
+//	画面合成に必要な状態を取り出す
+//	palettechanged/modechanged は取り出した側で処理するのでリセットする
+//
+void Screen::Capture(Frame* f, RasterLog* log)
+{
+	GetState(f);
+	f->palettechanged = palettechanged;
+	f->modechanged = modechanged;
+	palettechanged = false;
+	modechanged = false;
+	prevgmode = GetGMode();
+	prevpmode = GetPMode();
+	if (log)
+	{
+		log->nbands = rasterdraw.nbands;
+		memcpy(log->band, rasterdraw.band, rasterdraw.nbands * sizeof(Band));
+	}
+}
+
+// ---------------------------------------------------------------------------
+//	前回の合成から表示モード・パレットが変わったか
+//	帯ごとに合成している間は毎回変わったものとみなす
+//
+bool Screen::IsChanged()
+{
+	return palettechanged || modechanged || rastered || rasterpal
+		|| rasterdraw.nbands > 1
+		|| GetGMode() != prevgmode || GetPMode() != prevpmode;
+}
+
+// ---------------------------------------------------------------------------
+//	Capture で取り出した状態を反映する
+//
+void Screen::Restore(const Frame* f, const RasterLog* log)
+{
+	SetState(f);
+	palettechanged |= f->palettechanged;
+	modechanged |= f->modechanged;
+	if (log)
+	{
+		rasterdraw.nbands = log->nbands;
+		memcpy(rasterdraw.band, log->band, log->nbands * sizeof(Band));
+	}
+}
+
+// ---------------------------------------------------------------------------
+//	合成に関わるレジスタの状態 (変更フラグを除く)
+//	比較に使うので未使用部分も 0 にしておく
 //
-packed Screen::BETable0[1 << sizeof(packed)] = { -1 };
-packed Screen::BETable1[1 << sizeof(packed)];
-packed Screen::BETable2[1 << sizeof(packed)];
-packed Screen::E80Table[1 << sizeof(packed)];
-packed Screen::E80SRTable[64];
-packed Screen::E80SRMask[4];
-packed Screen::BE80Table[4];
+void Screen::GetState(Frame* f)
+{
+	memset(f, 0, sizeof(Frame));
+	memcpy(f->pal, pal, sizeof(pal));
+	f->bgpal = bgpal;
+	f->pex = pex;
+	f->port30 = port30;
+	f->port31 = port31;
+	f->port32 = port32;
+	f->port33 = port33;
+	f->port53 = port53;
+	f->gmask = gmask;
+	f->fullline = fullline;
+	f->fv15k = fv15k;
+	f->line400 = line400;
+	f->line320 = line320;
+	f->color = color;
+	f->displaygraphics = displaygraphics;
+	f->texttp = texttp;
+	f->n80mode = n80mode;
+	f->textpriority = textpriority;
+	f->grphpriority = grphpriority;
+}
 
+void Screen::SetState(const Frame* f)
+{
+	memcpy(pal, f->pal, sizeof(pal));
+	bgpal = f->bgpal;
+	pex = f->pex;
+	port30 = f->port30;
+	port31 = f->port31;
+	port32 = f->port32;
+	port33 = f->port33;
+	port53 = f->port53;
+	gmask = f->gmask;
+	fullline = f->fullline;
+	fv15k = f->fv15k;
+	line400 = f->line400;
+	line320 = f->line320;
+	color = f->color;
+	displaygraphics = f->displaygraphics;
+	texttp = f->texttp;
+	n80mode = f->n80mode;
+	textpriority = f->textpriority;
+	grphpriority = f->grphpriority;
+}
+
+// ---------------------------------------------------------------------------
+//	Table
+//	どれも定数から決まるので，コンパイル時に初期化子として展開する．
+//	実行時に作らないので，複数の Screen を同時に構築しても競合しない
+//
 #ifdef ENDIAN_IS_BIG
 	#define CHKBIT(i, j)	((1 << (sizeof(packed)-j)) & i)
 	#define BIT80SR			0
@@ -1506,60 +1819,35 @@ packed Screen::BE80Table[4];
 	#define	BIT80SR			1
 #endif
 
-void Screen::CreateTable()
-{
-	if (BETable0[0] == -1)
-	{
-		int i;
-		for (i=0; i<(1 << sizeof(packed)); i++)
-		{
-			int j;
-			packed p=0, q=0, r=0;
-
-			for (j=0; j<sizeof(packed); j++)
-			{
-				bool chkbit = CHKBIT(i,j) != 0;
-				p = (p << 8) | (chkbit ? GVRAM0_SET : GVRAM0_RES);
-				q = (q << 8) | (chkbit ? GVRAM1_SET : GVRAM1_RES);
-				r = (r << 8) | (chkbit ? GVRAM2_SET : GVRAM2_RES);
-			}
-			BETable0[i] = p;
-			BETable1[i] = q;
-			BETable2[i] = r;
-		}
-
-		for (i=0; i<(1 << sizeof(packed)); i++)
-		{
-			E80Table[i] = BETable0[(i & 0x05) | ((i & 0x05) << 1)]
-						| BETable1[(i & 0x0a) | ((i & 0x0a) >> 1)]
-						| PACK(GVRAM2_RES);
-		}
-
-		for (i=0; i<64; i++)
-		{
-			packed p;
-
-			p  = (i & 0x01) ? GVRAM0_SET : GVRAM0_RES;
-			p |= (i & 0x04) ? GVRAM1_SET : GVRAM1_RES;
-			p |= (i & 0x10) ? GVRAM2_SET : GVRAM2_RES;
-			E80SRTable[i] = p << (16 * BIT80SR);
-			p  = (i & 0x02) ? GVRAM0_SET : GVRAM0_RES;
-			p |= (i & 0x08) ? GVRAM1_SET : GVRAM1_RES;
-			p |= (i & 0x20) ? GVRAM2_SET : GVRAM2_RES;
-			E80SRTable[i] |= p << (16 * (1-BIT80SR));
-			E80SRTable[i] |= E80SRTable[i] << 8;
-		}
-
-		for (i=0; i<4; i++) 
-		{
-			E80SRMask[i]  = ((i & 1) ? 0xffff : 0x0000) << (16 * BIT80SR);
-			E80SRMask[i] |= ((i & 2) ? 0xffff : 0x0000) << (16 * (1-BIT80SR));
-			BE80Table[i]  = ((i & 1) ? GVRAM1_SET : GVRAM1_RES) << (16 * BIT80SR);
-			BE80Table[i] |= ((i & 2) ? GVRAM1_SET : GVRAM1_RES) << (16 * (1-BIT80SR));
-			BE80Table[i] |= BE80Table[i] << 8;
-		}
-	}
-}
+#define TABLE4(f, b)	f(b), f(b+1), f(b+2), f(b+3)
+#define TABLE16(f, b)	TABLE4(f, b), TABLE4(f, b+4), TABLE4(f, b+8), TABLE4(f, b+12)
+#define TABLE64(f, b)	TABLE16(f, b), TABLE16(f, b+16), TABLE16(f, b+32), TABLE16(f, b+48)
+
+// i の各ビットを 1 バイトに広げる (bit j → 上位から j 番目のバイト)
+#define BEBYTE(i, j, s, r)	(packed(CHKBIT((i), j) ? (s) : (r)) << (8 * (3-j)))
+#define BEPACK(i, s, r)		(BEBYTE(i, 0, s, r) | BEBYTE(i, 1, s, r) | BEBYTE(i, 2, s, r) | BEBYTE(i, 3, s, r))
+#define BE0(i)				BEPACK(i, GVRAM0_SET, GVRAM0_RES)
+#define BE1(i)				BEPACK(i, GVRAM1_SET, GVRAM1_RES)
+#define BE2(i)				BEPACK(i, GVRAM2_SET, GVRAM2_RES)
+#define E80(i)				(BE0(((i) & 0x05) | (((i) & 0x05) << 1)) \
+							| BE1(((i) & 0x0a) | (((i) & 0x0a) >> 1)) | PACK(GVRAM2_RES))
+
+// 320x200 カラー: 2 ドット分の B/R/G を 16bit ずつに置き，上のバイトにも写す
+#define SRHALF(i, b0, b1, b2)	(((i) & b0 ? GVRAM0_SET : GVRAM0_RES) \
+								| ((i) & b1 ? GVRAM1_SET : GVRAM1_RES) \
+								| ((i) & b2 ? GVRAM2_SET : GVRAM2_RES))
+#define SRWORD(lo, hi)		((packed(lo) << (16 * BIT80SR)) | (packed(hi) << (16 * (1-BIT80SR))))
+#define E80SR(i)			(SRWORD(SRHALF(i, 0x01, 0x04, 0x10), SRHALF(i, 0x02, 0x08, 0x20)) * 0x101)
+#define E80SRM(i)			SRWORD((i) & 1 ? 0xffff : 0, (i) & 2 ? 0xffff : 0)
+#define BE80(i)				(SRWORD((i) & 1 ? GVRAM1_SET : GVRAM1_RES, (i) & 2 ? GVRAM1_SET : GVRAM1_RES) * 0x101)
+
+const packed Screen::BETable0[1 << sizeof(packed)] = { TABLE16(BE0, 0) };
+const packed Screen::BETable1[1 << sizeof(packed)] = { TABLE16(BE1, 0) };
+const packed Screen::BETable2[1 << sizeof(packed)] = { TABLE16(BE2, 0) };
+const packed Screen::E80Table[1 << sizeof(packed)] = { TABLE16(E80, 0) };
+const packed Screen::E80SRTable[64] = { TABLE64(E80SR, 0) };
+const packed Screen::E80SRMask[4] = { TABLE4(E80SRM, 0) };
+const packed Screen::BE80Table[4] = { TABLE4(BE80, 0) };
 
 // ---------------------------------------------------------------------------
 //	状態保存
@@ -1598,6 +1886,9 @@ bool IFCALL Screen::LoadStatus(const uint8* s)
 	for (int i=0; i<8; i++)
 		pal[i] = st->pal[i];
 	modechanged = true;
+	rasterlog.nbands = 0;
+	rasterdraw.nbands = 0;
+	logtop = 0;
 	return true;
 }
 
@@ -1621,5 +1912,6 @@ const Device::OutFuncPtr Screen::outdef[] =
 	STATIC_CAST(Device::OutFuncPtr, &Out53),
 	STATIC_CAST(Device::OutFuncPtr, &Out54),
 	STATIC_CAST(Device::OutFuncPtr, &Out55to5b),
+	STATIC_CAST(Device::OutFuncPtr, &VRTC),
 };
 
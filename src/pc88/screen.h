@@ -12,6 +12,7 @@
 #include "device.h"
 #include "draw.h"
 #include "config.h"
+#include "pc88/memory.h"
 
 // ---------------------------------------------------------------------------
 //	color mode
@@ -25,7 +26,6 @@
 namespace PC8801
 {
 
-class Memory;
 class CRTC;
 
 // ---------------------------------------------------------------------------
@@ -36,7 +36,41 @@ class Screen : public Device
 public:
 	enum IDOut
 	{
-		reset=0, out30, out31, out32, out33, out52, out53, out54, out55to5b
+		reset=0, out30, out31, out32, out33, out52, out53, out54, out55to5b, vrtc
+	};
+	enum
+	{
+		maxbands = 16,
+	};
+
+	struct Pal
+	{
+		uint8 red, blue, green, _pad;
+	};
+	
+	// 画面合成に必要な状態 (ScreenPipe 用)
+	struct Frame
+	{
+		Pal pal[8], bgpal;
+		const uint8* pex;
+		uint8 port30, port31, port32, port33, port53;
+		uint8 gmask;
+		bool fullline, fv15k, line400, line320;
+		bool color, displaygraphics, texttp, n80mode;
+		bool textpriority, grphpriority;
+		bool palettechanged, modechanged;
+	};
+
+	// 表示期間中にレジスタが書き換えられた場合の帯ごとの状態
+	struct Band
+	{
+		int top;			// 帯の先頭ライン (0-399)
+		Frame state;
+	};
+	struct RasterLog
+	{
+		int nbands;			// 2 以上なら帯ごとに合成する
+		Band band[maxbands];
 	};
 
 public:
@@ -48,6 +82,10 @@ public:
 	bool UpdatePalette(Draw* draw);
 	void UpdateScreen(uint8* image, int bpl, Draw::Region& region, bool refresh);
 	void ApplyConfig(const Config* config);
+	void SetSource(Memory::quadbyte* gvram, uint8* dirty);
+	void Capture(Frame* frame, RasterLog* log);
+	void Restore(const Frame* frame, const RasterLog* log);
+	bool IsChanged();
 	
 	void IOCALL Out30(uint port, uint data);
 	void IOCALL Out31(uint port, uint data);
@@ -57,6 +95,7 @@ public:
 	void IOCALL Out53(uint port, uint data);
 	void IOCALL Out54(uint port, uint data);
 	void IOCALL Out55to5b(uint port, uint data);
+	void IOCALL VRTC(uint, uint en);
 	
 	const Descriptor* IFCALL GetDesc() const { return &descriptor; } 
 
@@ -65,10 +104,6 @@ public:
 	bool IFCALL LoadStatus(const uint8* status);
 
 private:
-	struct Pal
-	{
-		uint8 red, blue, green, _pad;
-	};
 	enum
 	{
 		ssrev = 1,
@@ -80,9 +115,21 @@ private:
 		uint8 p30, p31, p32, p33, p53;
 	};
 
-	void CreateTable();
-	
-	void ClearScreen(uint8* image, int bpl);
+	typedef void (Screen::*UpdateFunc)(uint8* image, int bpl, Draw::Region& region);
+
+	int GetGMode();
+	int GetPMode();
+	UpdateFunc GetUpdateFunc(int gmode);
+	void MakePalette(Draw::Palette* palette);
+	void GetState(Frame* frame);
+	void SetState(const Frame* frame);
+	void LogWrite();
+	void AppendBand(int top);
+	void UpdateScreenRaster(uint8* image, int bpl, Draw::Region& region);
+	bool UpdateRasterPalette(Draw* draw);
+	void MarkBand(UpdateFunc func, int top, int bottom);
+
+	void ClearScreen(uint8* image, int bpl, int top=0, int bottom=400);
 	void UpdateScreen200c(uint8* image, int bpl, Draw::Region& region);
 	void UpdateScreen200b(uint8* image, int bpl, Draw::Region& region);
 	void UpdateScreen400b(uint8* image, int bpl, Draw::Region& region);
@@ -95,6 +142,8 @@ private:
 	IOBus* bus;
 	Memory* memory;
 	CRTC* crtc;
+	Memory::quadbyte* gvram;	// 合成に使う GVRAM
+	uint8* dirtyflag;			// 合成に使う更新フラグ
 	
 	Pal pal[8];
 	Pal bgpal;
@@ -127,14 +176,20 @@ private:
 	bool grphpriority;
 	uint8 gmask;
 	Config::BASICMode newmode;
+
+	RasterLog rasterlog;		// 表示中のフレームの記録
+	RasterLog rasterdraw;		// 合成に使う直前のフレームの記録
+	int logtop;					// 記録中の帯の先頭ライン
+	bool rastered;				// 前回は帯ごとに合成した
+	bool rasterpal;				// 帯ごとのパレットを設定している
 	
-	static packed BETable0[1 << sizeof(packed)];
-	static packed BETable1[1 << sizeof(packed)];
-	static packed BETable2[1 << sizeof(packed)];
-	static packed E80Table[1 << sizeof(packed)];
-	static packed E80SRTable[64];
-	static packed E80SRMask[4];
-	static packed BE80Table[4];
+	static const packed BETable0[1 << sizeof(packed)];
+	static const packed BETable1[1 << sizeof(packed)];
+	static const packed BETable2[1 << sizeof(packed)];
+	static const packed E80Table[1 << sizeof(packed)];
+	static const packed E80SRTable[64];
+	static const packed E80SRMask[4];
+	static const packed BE80Table[4];
 	static const uint8 palextable[2][8];
 
 private:
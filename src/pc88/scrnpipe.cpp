@@ -0,0 +1,313 @@
+﻿// ---------------------------------------------------------------------------
+//	M88 - PC-8801 Emulator.
+// ---------------------------------------------------------------------------
+//	画面合成スレッド
+// ---------------------------------------------------------------------------
+
+#include "headers.h"
+#include "pc88/scrnpipe.h"
+#include "pc88/config.h"
+#include "error.h"
+#include "loadmon.h"
+
+#define LOGNAME "scrnpipe"
+#include "diag.h"
+
+using namespace PC8801;
+
+// ---------------------------------------------------------------------------
+//	構築/消滅
+//
+ScreenPipe::ScreenPipe()
+{
+	twincrtc = 0;
+	twinscrn = 0;
+	packet = 0;
+	readptr = 0;
+	writeptr = 0;
+	count = 0;
+	composing = false;
+	resync = false;
+	updated = false;
+	lowpriority = false;
+	rendered = 0;
+	merged = 0;
+	dropped = 0;
+	hthread = 0;
+	idthread = 0;
+	hevent = 0;
+	shouldterminate = false;
+}
+
+ScreenPipe::~ScreenPipe()
+{
+	Cleanup();
+}
+
+// ---------------------------------------------------------------------------
+//	初期化
+//
+bool ScreenPipe::Init(Memory* m, CRTC* c, Screen* s, Draw* d)
+{
+	mem = m, crtc = c, scrn = s, draw = d;
+
+	packet = new Packet[npackets];
+	twincrtc = new CRTC(DEV_ID('C', 'R', 'T', 'C'));
+	twinscrn = new Screen(DEV_ID('S', 'C', 'R', 'N'));
+	if (!packet || !twincrtc || !twinscrn)
+	{
+		Error::SetError(Error::OutOfMemory);
+		return false;
+	}
+	if (!twincrtc->InitComposer(crtc))
+		return false;
+	twinscrn->Init(0, 0, twincrtc);
+	twinscrn->SetSource(gvram, dirty);
+	memset(dirty, 0, sizeof(dirty));
+	pendingrefresh = false;
+	region.Reset();
+	Resync();
+
+	shouldterminate = false;
+	hevent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	hthread = HANDLE(_beginthreadex(NULL, 0, ThreadEntry,
+					   reinterpret_cast<void*> (this), 0, &idthread));
+	if (!hevent || !hthread)
+	{
+		Error::SetError(Error::ThreadInitFailed);
+		return false;
+	}
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+//	後片付
+//
+void ScreenPipe::Cleanup()
+{
+	if (hthread)
+	{
+		int i = 300;
+		do
+		{
+			shouldterminate = true;
+			SetEvent(hevent);
+		} while (--i > 0 && WAIT_TIMEOUT == WaitForSingleObject(hthread, 10));
+
+		if (!i)
+			TerminateThread(hthread, 0);
+
+		CloseHandle(hthread), hthread = 0;
+	}
+	if (hevent)
+		CloseHandle(hevent), hevent = 0;
+
+	LOG3("rendered: %d  merged: %d  dropped: %d\n", rendered, merged, dropped);
+	delete twinscrn;	twinscrn = 0;
+	delete twincrtc;	twincrtc = 0;
+	delete[] packet;	packet = 0;
+}
+
+// ---------------------------------------------------------------------------
+//	設定反映
+//
+void ScreenPipe::ApplyConfig(const Config* config)
+{
+	lowpriority = (config->flags & Config::drawprioritylow) != 0;
+}
+
+// ---------------------------------------------------------------------------
+//	次のパケットで合成側の状態をすべて送り直す
+//	合成スレッドを使っていない間に VM 側で合成が行われた場合に呼ぶ
+//
+void ScreenPipe::Resync()
+{
+	resync = true;
+}
+
+// ---------------------------------------------------------------------------
+//	合成スレッドが溜まっているパケットを処理し終えるまで待つ
+//
+void ScreenPipe::Flush()
+{
+	for (;;)
+	{
+		{
+			CriticalSection::Lock lock(cs);
+			if (!count && !composing)
+				break;
+		}
+		Sleep(1);
+	}
+}
+
+// ---------------------------------------------------------------------------
+//	現在の画面の状態をパケットに取り出して合成スレッドに渡す
+//	VM のスレッドから呼ばれる
+//
+void ScreenPipe::Capture(bool refresh)
+{
+	int n;
+	{
+		CriticalSection::Lock lock(cs);
+		n = count;
+	}
+	if (n >= npackets)
+	{
+		// 合成が追いついていないのでこのフレームは捨てる．
+		// 更新フラグ等は VM 側に残るので次のパケットにまとめられる
+		dropped++;
+		pendingrefresh = pendingrefresh || refresh;
+		return;
+	}
+
+	Packet& p = packet[writeptr];
+	p.refresh = refresh || pendingrefresh;
+	pendingrefresh = false;
+
+	bool full = resync;
+	if (full)
+	{
+		// GVRAM・フォント・attr をすべて送る
+		resync = false;
+		p.refresh = true;
+		memset(mem->GetDirtyFlag(), 1, 0x400);
+		fontgen = ~crtc->GetFontGeneration();
+	}
+
+	p.fontvalid = crtc->GetFontGeneration() != fontgen;
+	crtc->Capture(&p.crtc, p.text, p.fontvalid ? p.font : 0);
+	fontgen = p.crtc.fontgen;
+	if (full)
+		p.crtc.newattr = true;
+	scrn->Capture(&p.scrn, &p.raster);
+
+	// 更新された GVRAM のブロックだけを写す
+	uint8* d = mem->GetDirtyFlag();
+	const Memory::quadbyte* g = mem->GetGVRAM();
+	memcpy(p.dirty, d, 0x400);
+	for (int i=0; i<0x400; i++)
+	{
+		if (d[i])
+			memcpy(&p.gvram[i * 16], &g[i * 16], 16 * sizeof(Memory::quadbyte));
+	}
+	memset(d, 0, 0x400);
+
+	writeptr = (writeptr + 1) % npackets;
+	{
+		CriticalSection::Lock lock(cs);
+		count++;
+	}
+	SetEvent(hevent);
+}
+
+// ---------------------------------------------------------------------------
+//	溜まっているパケットをすべて反映してから合成する
+//
+void ScreenPipe::Compose()
+{
+	int n;
+	{
+		CriticalSection::Lock lock(cs);
+		n = count;
+		if (!n)
+			return;
+		composing = true;
+	}
+
+	bool refresh = false;
+	for (int i=0; i<n; i++)
+	{
+		const Packet& p = packet[readptr];
+		refresh = refresh || p.refresh;
+		twincrtc->Restore(&p.crtc, p.text, p.fontvalid ? p.font : 0);
+		twinscrn->Restore(&p.scrn, &p.raster);
+		for (int j=0; j<0x400; j++)
+		{
+			if (p.dirty[j])
+			{
+				dirty[j] = 1;
+				memcpy(&gvram[j * 16], &p.gvram[j * 16], 16 * sizeof(Memory::quadbyte));
+			}
+		}
+		readptr = (readptr + 1) % npackets;
+	}
+	{
+		CriticalSection::Lock lock(cs);
+		count -= n;
+	}
+	merged += n - 1;
+	Render(refresh);
+
+	CriticalSection::Lock lock(cs);
+	composing = false;
+}
+
+// ---------------------------------------------------------------------------
+//	画面合成と描画
+//	PC88::UpdateScreen と同じ手順で行う
+//
+void ScreenPipe::Render(bool refresh)
+{
+	int dstat = draw->GetStatus();
+	if (dstat & Draw::shouldrefresh)
+		refresh = true;
+
+	LOADBEGIN("ScreenPipe");
+	if (!updated || refresh)
+	{
+		if (!lowpriority || (dstat & (Draw::readytodraw | Draw::shouldrefresh)))
+		{
+			int	bpl;
+			uint8* image;
+
+			if (draw->Lock(&image, &bpl))
+			{
+				twincrtc->UpdateScreen(image, bpl, region, refresh);
+				twinscrn->UpdateScreen(image, bpl, region, refresh);
+				bool palchanged = twinscrn->UpdatePalette(draw);
+				draw->Unlock();
+				updated = palchanged || region.Valid();
+			}
+		}
+	}
+	LOADEND("ScreenPipe");
+	if (draw->GetStatus() & Draw::readytodraw)
+	{
+		if (updated)
+		{
+			updated = false;
+			draw->DrawScreen(region);
+			region.Reset();
+		}
+		else
+		{
+			Draw::Region r;
+			r.Reset();
+			draw->DrawScreen(r);
+		}
+	}
+	if (!(++rendered & 255))
+		LOG3("rendered: %d  merged: %d  dropped: %d\n", rendered, merged, dropped);
+}
+
+// ---------------------------------------------------------------------------
+//	合成スレッド
+//
+uint ScreenPipe::ThreadMain()
+{
+	while (!shouldterminate)
+	{
+		WaitForSingleObject(hevent, 1000);
+		Compose();
+	}
+	return 0;
+}
+
+uint __stdcall ScreenPipe::ThreadEntry(LPVOID arg)
+{
+	if (arg)
+		return reinterpret_cast<ScreenPipe*> (arg)->ThreadMain();
+	else
+		return 0;
+}
@@ -0,0 +1,109 @@
+﻿// ---------------------------------------------------------------------------
+//	M88 - PC-8801 Emulator.
+// ---------------------------------------------------------------------------
+//	画面合成スレッド
+// ---------------------------------------------------------------------------
+
+#pragma once
+
+#include "types.h"
+#include "draw.h"
+#include "critsect.h"
+#include "pc88/memory.h"
+#include "pc88/crtc.h"
+#include "pc88/screen.h"
+
+namespace PC8801
+{
+
+// ---------------------------------------------------------------------------
+//	ScreenPipe
+//
+//	VSync 時に画面合成に必要な状態 (更新された GVRAM ブロック，テキスト，
+//	パレット・モード) をフレームパケットに取り出し，別スレッドで合成する．
+//	合成スレッドは CRTC/Screen の複製を持ち，溜まったパケットをすべて
+//	反映してから 1 回だけ合成するため，表示の遅れは最大 1 フレーム分の
+//	合成時間に収まる．
+//	リングが一杯の時はパケットを作らず，更新フラグを VM 側に残したまま
+//	次のフレームにまとめる．
+//
+class ScreenPipe
+{
+public:
+	enum
+	{
+		npackets = 3,
+	};
+
+public:
+	ScreenPipe();
+	~ScreenPipe();
+
+	bool Init(Memory* mem, CRTC* crtc, Screen* scrn, Draw* draw);
+	void Cleanup();
+
+	void Capture(bool refresh);
+	void Resync();
+	void Flush();
+	void ApplyConfig(const Config* config);
+
+	uint GetRenderedCount() { return rendered; }
+	uint GetMergedCount() { return merged; }
+	uint GetDroppedCount() { return dropped; }
+	bool IsPending() { return updated; }
+
+private:
+	struct Packet
+	{
+		bool refresh;
+		bool fontvalid;
+		CRTC::Frame crtc;
+		Screen::Frame scrn;
+		Screen::RasterLog raster;
+		uint8 dirty[0x400];
+		Memory::quadbyte gvram[0x4000];
+		uint8 text[CRTC::textsize];
+		uint8 font[CRTC::fontsize];
+	};
+
+	void Compose();
+	void Render(bool refresh);
+
+	uint ThreadMain();
+	static uint __stdcall ThreadEntry(LPVOID arg);
+
+	Memory* mem;
+	CRTC* crtc;
+	Screen* scrn;
+	Draw* draw;
+
+	CRTC* twincrtc;					// 合成用の CRTC
+	Screen* twinscrn;				// 合成用の Screen
+	Memory::quadbyte gvram[0x4000];	// 合成用の GVRAM
+	uint8 dirty[0x400];				// 合成用の更新フラグ
+
+	Packet* packet;
+	int readptr;					// 合成スレッドが次に読むパケット
+	int writeptr;					// VM が次に書くパケット
+	int count;						// 溜まっているパケットの数
+	bool composing;					// 合成スレッドが処理中
+	volatile bool resync;			// 次のパケットですべてを送り直す
+	uint fontgen;					// 最後に送ったフォントの世代
+	bool pendingrefresh;			// 捨てたフレームの refresh 要求
+
+	Draw::Region region;
+	volatile bool updated;			// 合成したがまだ描画していない
+	volatile bool lowpriority;
+
+	uint rendered;					// 合成したフレーム数
+	uint merged;					// 合成前にまとめたフレーム数
+	uint dropped;					// リングが一杯で捨てたフレーム数
+
+	CriticalSection cs;
+	HANDLE hthread;
+	uint idthread;
+	HANDLE hevent;
+	volatile bool shouldterminate;
+};
+
+}
@@ -127,6 +127,9 @@ void LoadConfig(Config* cfg, const char* inifile, bool applydefault)
 
 	if (LoadConfigEntry(inifile, "ROMEOLatency", &n, 100, applydefault))
 		cfg->romeolatency = Limit(n, 500, 0);
+
+	if (LoadConfigEntry(inifile, "ScreenScale", &n, 1, applydefault))
+		cfg->scale = Limit(n, 4, 1);
 	
 	LOADVOLUMEENTRY("VolumeFM", VOLUME_BIAS, cfg->volfm);
 	LOADVOLUMEENTRY("VolumeSSG", 97, cfg->volssg);
@@ -200,6 +203,7 @@ void SaveConfig(Config* cfg, const char* inifile, bool writedefault)
 	SaveEntry(inifile, "LPFCutoff", cfg->lpffc, writedefault);
 	SaveEntry(inifile, "LPFOrder", cfg->lpforder, writedefault);
 	SaveEntry(inifile, "ROMEOLatency", cfg->romeolatency, writedefault);
+	SaveEntry(inifile, "ScreenScale", cfg->scale, writedefault);
 
 	SaveEntry(inifile, "VolumeFM", cfg->volfm + VOLUME_BIAS, writedefault);
 	SaveEntry(inifile, "VolumeSSG", cfg->volssg + VOLUME_BIAS, writedefault);
@@ -30,7 +30,10 @@ WinDrawD2D::WinDrawD2D() :
 	m_D2DFact(0),
 	m_RenderTarget(0),
 	m_UpdatePal(false),
-	m_hBitmap(0)
+	m_hBitmap(0),
+	m_nBands(0),
+	m_Scale(1),
+	m_ScaleMask(0)
 {
 }
 
@@ -123,16 +126,21 @@ bool WinDrawD2D::Resize( uint _width, uint _height )
 	m_height = _height;
 
 	status |= Draw::shouldrefresh;
+	m_UpdatePal = true;
 
 	HRESULT hr = S_OK;
 
-	::SetWindowPos( m_hCWnd, HWND_BOTTOM, 0, 0, 640, 400, SWP_SHOWWINDOW);
+	// 拡大する場合は子ウィンドウと render target も拡大後の大きさにする
+	m_Scaler.Init( m_hWnd, m_width, m_height, m_Scale, m_ScaleMask );
+	uint scale = m_Scaler.GetScale();
+
+	::SetWindowPos( m_hCWnd, HWND_BOTTOM, 0, 0, m_width * scale, m_height * scale, SWP_SHOWWINDOW);
 
 	if ( !m_RenderTarget ) {
 
 		D2D1_SIZE_U size = D2D1::SizeU(
-			_width,
-			_height
+			_width * scale,
+			_height * scale
 			);
 
 		D2D1_RENDER_TARGET_PROPERTIES RTProps = D2D1::RenderTargetProperties();
@@ -179,6 +187,7 @@ bool WinDrawD2D::Resize( uint _width, uint _height )
 //
 bool WinDrawD2D::Cleanup()
 {
+	m_Scaler.Cleanup();
 	SafeRelease( &m_GDIRT );
 	SafeRelease( &m_RenderTarget );
 	SafeRelease( &m_D2DFact );
@@ -228,7 +237,8 @@ bool WinDrawD2D::MakeBitmap()
 									NULL,
 									0 );
 
-	RECT rect = { 0,0,640,400 };
+	RECT rect;
+	::SetRect( &rect, 0, 0, m_width * m_Scaler.GetScale(), m_height * m_Scaler.GetScale() );
 	m_GDIRT->ReleaseDC( &rect );
 	m_RenderTarget->EndDraw();
 
@@ -256,6 +266,39 @@ void WinDrawD2D::SetPalette(PALETTEENTRY* _pe, int index, int nentries)
 	m_UpdatePal = true;
 }
 
+//! 帯ごとのパレット設定
+//	pal は 1 帯あたり 256 エントリ，n = 0 で通常のパレットに戻る
+//
+bool WinDrawD2D::SetRasterPalette(int _n, const int* _top, const PALETTEENTRY* _pe)
+{
+	if ( _n > maxbands ) {
+		return false;
+	}
+	for ( int i = 0; i < _n; i++ ) {
+		m_BandTop[i] = _top[i];
+		for ( int j = 0; j < 256; j++, _pe++ ) {
+			m_BandColors[i][j].rgbRed      = _pe->peRed;
+			m_BandColors[i][j].rgbBlue     = _pe->peBlue;
+			m_BandColors[i][j].rgbGreen    = _pe->peGreen;
+			m_BandColors[i][j].rgbReserved = 0;
+		}
+	}
+	m_nBands = _n;
+	m_UpdatePal = true;
+	return true;
+}
+
+//! 拡大率と効果の設定
+//	拡大できない時は等倍で描画する
+//
+bool WinDrawD2D::SetScaleMode(uint _scale, uint _mask)
+{
+	m_Scale = _scale;
+	m_ScaleMask = _mask;
+	Resize( m_width, m_height );
+	return m_Scaler.GetScale() == (uint)Max( _scale, 1 );
+}
+
 //! 描画
 //
 void WinDrawD2D::DrawScreen(const RECT& _rect, bool refresh)
@@ -276,22 +319,50 @@ void WinDrawD2D::DrawScreen(const RECT& _rect, bool refresh)
 		valid = true;
 	}
 
-	if (valid) {
+	if ( valid && m_Scaler.IsEnabled() ) {
+		// 拡大は更新範囲だけ行う．帯ごとのパレットも色テーブルで扱える
+		if ( m_UpdatePal ) {
+			m_UpdatePal = false;
+			m_Scaler.SetPalette( m_nBands, m_BandTop, m_nBands ? m_BandColors[0] : m_bmpinfo.colors );
+		}
+		m_Scaler.Update( m_image, bpl, rc );
+
+		HDC hDC = NULL;
+		m_GDIRT->GetDC( D2D1_DC_INITIALIZE_MODE_COPY, &hDC );
+		m_Scaler.Blt( hDC, rc );
+
+		RECT rect;
+		::SetRect( &rect, 0, 0, m_width * m_Scaler.GetScale(), m_height * m_Scaler.GetScale() );
+		m_GDIRT->ReleaseDC( &rect );
+	}
+	else if (valid) {
 		HRESULT hr;
 		HDC hDC = NULL;
 		hr = m_GDIRT->GetDC( D2D1_DC_INITIALIZE_MODE_COPY, &hDC );
 
 		HDC hmemdc = ::CreateCompatibleDC( hDC );
 		HBITMAP oldbitmap = (HBITMAP)::SelectObject( hmemdc, m_hBitmap );
-		if ( m_UpdatePal ) {
-			m_UpdatePal = false;
-			::SetDIBColorTable( hmemdc, 0, 0x100, m_bmpinfo.colors );
+		if ( m_nBands ) {
+			// 帯ごとにカラーテーブルを切り替えて転送する
+			for ( int i = 0; i < m_nBands; i++ ) {
+				int top = i ? Min( m_BandTop[i], (int)m_height ) : 0;
+				int bottom = i + 1 < m_nBands ? Min( m_BandTop[i + 1], (int)m_height ) : m_height;
+				::SetDIBColorTable( hmemdc, 0, 0x100, m_BandColors[i] );
+				::BitBlt( hDC, 0, top, m_width, bottom - top, hmemdc, 0, top, SRCCOPY );
+			}
+			m_UpdatePal = true;
+		}
+		else {
+			if ( m_UpdatePal ) {
+				m_UpdatePal = false;
+				::SetDIBColorTable( hmemdc, 0, 0x100, m_bmpinfo.colors );
+			}
+
+			::BitBlt( hDC, rc.left, rc.top,
+					  rc.right - rc.left, rc.bottom - rc.top,
+					  hmemdc, rc.left, rc.top,
+					  SRCCOPY);
 		}
-
-		::BitBlt( hDC, rc.left, rc.top,
-				  rc.right - rc.left, rc.bottom - rc.top,
-				  hmemdc, rc.left, rc.top,
-				  SRCCOPY);
 
 		::SelectObject( hmemdc, oldbitmap );
 		::DeleteDC( hmemdc );
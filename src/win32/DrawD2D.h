@@ -12,6 +12,7 @@
 #include <d2d1.h>
 #include <d2d1helper.h>
 #include "windraw.h"
+#include "scaler.h"
 
 class WinDrawD2D : public WinDrawSub
 {
@@ -23,6 +24,9 @@ public:
 	bool Resize(uint width, uint height);
 	bool Cleanup();
 	void SetPalette(PALETTEENTRY* pal, int index, int nentries);
+	bool SetRasterPalette(int nbands, const int* top, const PALETTEENTRY* pal);
+	bool SetScaleMode(uint scale, uint mask);
+	uint GetScale() { return m_Scaler.GetScale(); }
 	void SetGUIMode(bool guimode);
 	void DrawScreen(const RECT& rect, bool refresh);
 	bool Lock(uint8** pimage, int* pbpl);
@@ -39,6 +43,8 @@ private:
 
 	bool	MakeBitmap();
 
+	enum { maxbands = 16 };
+
 	ID2D1Factory *m_D2DFact;
 	ID2D1HwndRenderTarget *m_RenderTarget;
 	ID2D1GdiInteropRenderTarget *m_GDIRT;
@@ -52,4 +58,10 @@ private:
 	BI256	m_bmpinfo;
 	HBITMAP	m_hBitmap;
 	int		bpl;
+	int		m_nBands;						// 帯ごとのカラーテーブルの数
+	int		m_BandTop[maxbands];
+	RGBQUAD	m_BandColors[maxbands][256];
+	uint	m_Scale;						// 拡大率
+	uint	m_ScaleMask;
+	Scaler	m_Scaler;
 };
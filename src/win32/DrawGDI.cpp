@@ -15,7 +15,8 @@
 //	構築/消滅
 //
 WinDrawGDI::WinDrawGDI()
-: hwnd(0), hbitmap(0), updatepal(false), bitmapimage(0), image(0)
+: hwnd(0), hbitmap(0), updatepal(false), bitmapimage(0), image(0), nbands(0),
+  scale(1), scalemask(0)
 {
 }
 
@@ -48,6 +49,8 @@ bool WinDrawGDI::Resize(uint w, uint h)
 		return false;
 
 	memset(image, 0x40, width * height);
+	scaler.Init(hwnd, width, height, scale, scalemask);
+	updatepal = true;
 	status |= Draw::shouldrefresh;
 	return true;
 }
@@ -57,6 +60,7 @@ bool WinDrawGDI::Resize(uint w, uint h)
 //
 bool WinDrawGDI::Cleanup()
 {
+	scaler.Cleanup();
 	if (hbitmap)
 	{
 		DeleteObject(hbitmap), hbitmap = 0;
@@ -121,6 +125,43 @@ void WinDrawGDI::SetPalette(PALETTEENTRY* pe, int index, int nentries)
 	updatepal = true;
 }
 
+// ---------------------------------------------------------------------------
+//	帯ごとのパレット設定
+//	pal は 1 帯あたり 256 エントリ，n = 0 で通常のパレットに戻る
+//
+bool WinDrawGDI::SetRasterPalette(int n, const int* top, const PALETTEENTRY* pe)
+{
+	if (n > maxbands)
+		return false;
+	for (int i=0; i<n; i++)
+	{
+		bandtop[i] = top[i];
+		for (int j=0; j<256; j++, pe++)
+		{
+			bandcolors[i][j].rgbRed = pe->peRed;
+			bandcolors[i][j].rgbBlue = pe->peBlue;
+			bandcolors[i][j].rgbGreen = pe->peGreen;
+			bandcolors[i][j].rgbReserved = 0;
+		}
+	}
+	nbands = n;
+	updatepal = true;
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+//	拡大率と効果の設定
+//	拡大できない時は等倍で描画する
+//
+bool WinDrawGDI::SetScaleMode(uint s, uint m)
+{
+	scale = s, scalemask = m;
+	bool r = scaler.Init(hwnd, width, height, scale, scalemask);
+	updatepal = true;
+	status |= Draw::shouldrefresh;
+	return r;
+}
+
 // ---------------------------------------------------------------------------
 //	描画
 //
@@ -132,21 +173,50 @@ void WinDrawGDI::DrawScreen(const RECT& _rect, bool refresh)
 	if (refresh || updatepal)
 		SetRect(&rect, 0, 0, width, height), valid = true;
 	
-	if (valid)
+	if (valid && scaler.IsEnabled())
+	{
+		// 拡大は更新範囲だけ行う．帯ごとのパレットも色テーブルで扱える
+		if (updatepal)
+		{
+			updatepal = false;
+			scaler.SetPalette(nbands, bandtop, nbands ? bandcolors[0] : binfo.colors);
+		}
+		scaler.Update(image, bpl, rect);
+
+		HDC hdc = GetDC(hwnd);
+		scaler.Blt(hdc, rect);
+		ReleaseDC(hwnd, hdc);
+	}
+	else if (valid)
 	{
 		HDC hdc = GetDC(hwnd);
 		HDC hmemdc = CreateCompatibleDC(hdc);
 		HBITMAP oldbitmap = (HBITMAP) SelectObject(hmemdc, hbitmap);
-		if (updatepal)
+		if (nbands)
 		{
-			updatepal = false;
-			SetDIBColorTable(hmemdc, 0, 0x100, binfo.colors);
+			// 帯ごとにカラーテーブルを切り替えて転送する
+			for (int i=0; i<nbands; i++)
+			{
+				int top = i ? Min(bandtop[i], (int) height) : 0;
+				int bottom = i+1 < nbands ? Min(bandtop[i+1], (int) height) : height;
+				SetDIBColorTable(hmemdc, 0, 0x100, bandcolors[i]);
+				BitBlt(hdc, 0, top, width, bottom - top, hmemdc, 0, top, SRCCOPY);
+			}
+			updatepal = true;
+		}
+		else
+		{
+			if (updatepal)
+			{
+				updatepal = false;
+				SetDIBColorTable(hmemdc, 0, 0x100, binfo.colors);
+			}
+			
+			BitBlt(hdc, rect.left, rect.top, 
+				        rect.right - rect.left, rect.bottom - rect.top, 
+				   hmemdc, rect.left, rect.top, 
+				   SRCCOPY);
 		}
-		
-		BitBlt(hdc, rect.left, rect.top, 
-			        rect.right - rect.left, rect.bottom - rect.top, 
-			   hmemdc, rect.left, rect.top, 
-			   SRCCOPY);
 		
 		SelectObject(hmemdc, oldbitmap);
 		DeleteDC(hmemdc);
@@ -12,6 +12,7 @@
 // ---------------------------------------------------------------------------
 
 #include "windraw.h"
+#include "scaler.h"
 
 class WinDrawGDI : public WinDrawSub
 {
@@ -23,11 +24,15 @@ public:
 	bool Resize(uint width, uint height);
 	bool Cleanup();
 	void SetPalette(PALETTEENTRY* pal, int index, int nentries);
+	bool SetRasterPalette(int nbands, const int* top, const PALETTEENTRY* pal);
+	bool SetScaleMode(uint scale, uint mask);
+	uint GetScale() { return scaler.GetScale(); }
 	void DrawScreen(const RECT& rect, bool refresh);
 	bool Lock(uint8** pimage, int* pbpl);
 	bool Unlock();
 
 private:
+	enum { maxbands = 16 };
 	struct BI256		// BITMAPINFO
 	{
 		BITMAPINFOHEADER header;
@@ -46,6 +51,12 @@ private:
 	uint	height;
 	bool	updatepal;
 	BI256	binfo;
+	int		nbands;						// 帯ごとのカラーテーブルの数
+	int		bandtop[maxbands];
+	RGBQUAD	bandcolors[maxbands][256];
+	uint	scale;						// 拡大率
+	uint	scalemask;
+	Scaler	scaler;
 };
 
 #endif // !defined(win32_drawgdi_h)
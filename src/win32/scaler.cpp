@@ -0,0 +1,408 @@
+﻿// ---------------------------------------------------------------------------
+//	M88 - PC-8801 Emulator.
+// ---------------------------------------------------------------------------
+//	画面の拡大
+// ---------------------------------------------------------------------------
+
+#include "headers.h"
+#include "misc.h"
+#include "scaler.h"
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define SCALER_SSE2
+#include <emmintrin.h>
+#endif
+
+#define LOGNAME "scaler"
+#include "diag.h"
+
+// ---------------------------------------------------------------------------
+//	効果の強さ
+//
+//	スキャンライン: 拡大後の各行の明るさ (256 = 1.0)
+static const int scanweight[Scaler::maxscale + 1][Scaler::maxscale] =
+{
+	{ 256, 256, 256, 256 },
+	{ 256, 256, 256, 256 },
+	{ 256, 128, 256, 256 },
+	{ 256, 256, 128, 256 },
+	{ 256, 256, 176,  96 },
+};
+
+//	アパーチャグリル: 強調しない色成分の明るさ
+static const int aperturedim = 176;
+
+// ---------------------------------------------------------------------------
+//	構築/消滅
+//
+Scaler::Scaler()
+{
+	hbitmap = 0;
+	image = 0;
+	width = height = 0;
+	scale = 1;
+	mask = 0;
+	nbands = 1;
+	bandtop[0] = 0;
+	nworkers = 0;
+	shouldterminate = false;
+	memset(table, 0, sizeof(table));
+}
+
+Scaler::~Scaler()
+{
+	Cleanup();
+}
+
+// ---------------------------------------------------------------------------
+//	初期化
+//	scale が 1 以下なら拡大しない
+//
+bool Scaler::Init(HWND hwnd, uint w, uint h, uint s, uint m)
+{
+	Cleanup();
+
+	width = w, height = h;
+	scale = Limit(s, maxscale, 1);
+	mask = m;
+	if (scale <= 1)
+		return true;
+
+	BITMAPINFOHEADER bi;
+	memset(&bi, 0, sizeof(bi));
+	bi.biSize = sizeof(BITMAPINFOHEADER);
+	bi.biWidth = width * scale;
+	bi.biHeight = -(int) (height * scale);
+	bi.biPlanes = 1;
+	bi.biBitCount = 32;
+	bi.biCompression = BI_RGB;
+
+	HDC hdc = GetDC(hwnd);
+	hbitmap = CreateDIBSection(hdc, (BITMAPINFO*) &bi, DIB_RGB_COLORS,
+							   (void**)(&image), NULL, 0);
+	ReleaseDC(hwnd, hdc);
+	if (!hbitmap)
+	{
+		image = 0;
+		return false;
+	}
+	dbpl = width * scale;
+	memset(image, 0, dbpl * height * scale * sizeof(uint32));
+
+	for (uint i=0; i<maxscale; i++)
+		weight[i] = (mask & scanline) ? scanweight[scale][i] : 256;
+
+	StartWorkers();
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+//	後片付け
+//
+void Scaler::Cleanup()
+{
+	StopWorkers();
+	if (hbitmap)
+		DeleteObject(hbitmap), hbitmap = 0;
+	image = 0;
+}
+
+// ---------------------------------------------------------------------------
+//	パレット設定
+//	colors は 1 帯あたり 256 エントリ，nbands = 0 なら 1 帯だけ
+//
+void Scaler::SetPalette(int n, const int* top, const RGBQUAD* colors)
+{
+	nbands = Limit(n, maxbands, 1);
+	bandtop[0] = 0;
+	for (int i=0; i<nbands; i++)
+	{
+		if (i)
+			bandtop[i] = top[i];
+		BuildTable(table[i], colors + i * 256);
+	}
+}
+
+// ---------------------------------------------------------------------------
+//	色テーブルを作る
+//	アパーチャグリルの効果は出力の列 % 3 ごとのテーブルに織り込む
+//
+void Scaler::BuildTable(uint32 (*t)[256], const RGBQUAD* colors)
+{
+	for (int p=0; p<3; p++)
+	{
+		int wr = 256, wg = 256, wb = 256;
+		if (mask & aperture)
+		{
+			wr = p == 0 ? 256 : aperturedim;
+			wg = p == 1 ? 256 : aperturedim;
+			wb = p == 2 ? 256 : aperturedim;
+		}
+		for (int i=0; i<256; i++)
+		{
+			t[p][i] = 0xff000000
+					| ((colors[i].rgbRed   * wr >> 8) << 16)
+					| ((colors[i].rgbGreen * wg >> 8) << 8)
+					|  (colors[i].rgbBlue  * wb >> 8);
+		}
+	}
+}
+
+// ---------------------------------------------------------------------------
+//	更新範囲を拡大する
+//	rect は元の画面の座標
+//
+void Scaler::Update(const uint8* src, int bpl, const RECT& rect)
+{
+	if (!hbitmap)
+		return;
+
+	int top = Max(rect.top, 0);
+	int bottom = Min(rect.bottom, height);
+	jobleft = Max(rect.left, 0);
+	jobright = Min(rect.right, width);
+	if (jobleft >= jobright || top >= bottom)
+		return;
+	jobsrc = src;
+	jobbpl = bpl;
+
+	// 範囲が小さい時はスレッドを起こす方が高くつく
+	int rows = bottom - top;
+	int n = Min(nworkers + 1, rows / minrows);
+	if (n <= 1)
+	{
+		ConvertBand(top, bottom);
+		return;
+	}
+
+	int step = (rows + n - 1) / n;
+	HANDLE hdone[maxworkers];
+	for (int i=1; i<n; i++)
+	{
+		Worker& w = worker[i-1];
+		w.top = top + step * i;
+		w.bottom = Min(w.top + step, bottom);
+		hdone[i-1] = w.hdone;
+		SetEvent(w.hstart);
+	}
+	ConvertBand(top, top + step);
+	WaitForMultipleObjects(n-1, hdone, TRUE, INFINITE);
+}
+
+// ---------------------------------------------------------------------------
+//	拡大したイメージを転送する
+//	rect は元の画面の座標
+//
+void Scaler::Blt(HDC hdc, const RECT& rect)
+{
+	if (!hbitmap)
+		return;
+
+	HDC hmemdc = CreateCompatibleDC(hdc);
+	HBITMAP oldbitmap = (HBITMAP) SelectObject(hmemdc, hbitmap);
+	BitBlt(hdc, rect.left * scale, rect.top * scale,
+		        (rect.right - rect.left) * scale, (rect.bottom - rect.top) * scale,
+		   hmemdc, rect.left * scale, rect.top * scale,
+		   SRCCOPY);
+	SelectObject(hmemdc, oldbitmap);
+	DeleteDC(hmemdc);
+}
+
+// ---------------------------------------------------------------------------
+//	top から bottom までのラインを拡大する
+//	複数のスレッドから同時に呼ばれる
+//
+void Scaler::ConvertBand(int top, int bottom)
+{
+	int n = jobright - jobleft;
+	int b = 0;
+	for (int y=top; y<bottom; y++)
+	{
+		while (b+1 < nbands && y >= bandtop[b+1])
+			b++;
+
+		uint32* d = image + y * scale * dbpl + jobleft * scale;
+		ExpandLine(d, jobsrc + y * jobbpl + jobleft, n, table[b]);
+		for (uint r=1; r<scale; r++)
+			CopyLine(d + r * dbpl, d, n * scale, weight[r]);
+	}
+}
+
+// ---------------------------------------------------------------------------
+//	1 ラインを横に拡大する
+//
+void Scaler::ExpandLine(uint32* dest, const uint8* src, int n, const uint32 (*t)[256])
+{
+	if (mask & aperture)
+	{
+		int p = (jobleft * scale) % 3;
+		for (int x=0; x<n; x++)
+		{
+			uint c = src[x];
+			for (uint i=0; i<scale; i++)
+			{
+				*dest++ = t[p][c];
+				p = p < 2 ? p + 1 : 0;
+			}
+		}
+		return;
+	}
+
+	const uint32* t0 = t[0];
+	int x = 0;
+#ifdef SCALER_SSE2
+	// 4 画素ずつ色を引いて並べ替える
+	__m128i* d = (__m128i*) dest;
+	switch (scale)
+	{
+	case 2:
+		for (; x+4<=n; x+=4, d+=2)
+		{
+			__m128i v = _mm_setr_epi32(t0[src[x]], t0[src[x+1]], t0[src[x+2]], t0[src[x+3]]);
+			_mm_storeu_si128(d+0, _mm_unpacklo_epi32(v, v));
+			_mm_storeu_si128(d+1, _mm_unpackhi_epi32(v, v));
+		}
+		break;
+
+	case 3:
+		for (; x+4<=n; x+=4, d+=3)
+		{
+			__m128i v = _mm_setr_epi32(t0[src[x]], t0[src[x+1]], t0[src[x+2]], t0[src[x+3]]);
+			_mm_storeu_si128(d+0, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 0, 0)));
+			_mm_storeu_si128(d+1, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 2, 1, 1)));
+			_mm_storeu_si128(d+2, _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 2)));
+		}
+		break;
+
+	case 4:
+		for (; x+4<=n; x+=4, d+=4)
+		{
+			__m128i v = _mm_setr_epi32(t0[src[x]], t0[src[x+1]], t0[src[x+2]], t0[src[x+3]]);
+			_mm_storeu_si128(d+0, _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 0, 0, 0)));
+			_mm_storeu_si128(d+1, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 1, 1, 1)));
+			_mm_storeu_si128(d+2, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 2, 2, 2)));
+			_mm_storeu_si128(d+3, _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 3)));
+		}
+		break;
+	}
+	dest += x * scale;
+#endif
+	for (; x<n; x++)
+	{
+		uint32 c = t0[src[x]];
+		for (uint i=0; i<scale; i++)
+			*dest++ = c;
+	}
+}
+
+// ---------------------------------------------------------------------------
+//	ラインを明るさ weight で写す
+//
+void Scaler::CopyLine(uint32* dest, const uint32* src, int n, int w)
+{
+	if (w >= 256)
+	{
+		memcpy(dest, src, n * sizeof(uint32));
+		return;
+	}
+
+	int x = 0;
+#ifdef SCALER_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i mul = _mm_set1_epi16(w);
+	const __m128i alpha = _mm_set1_epi32(int(0xff000000));
+	for (; x+4<=n; x+=4)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*) (src + x));
+		__m128i lo = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(v, zero), mul), 8);
+		__m128i hi = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(v, zero), mul), 8);
+		_mm_storeu_si128((__m128i*) (dest + x), _mm_or_si128(_mm_packus_epi16(lo, hi), alpha));
+	}
+#endif
+	for (; x<n; x++)
+	{
+		uint32 c = src[x];
+		dest[x] = 0xff000000
+				| (((c >> 16 & 0xff) * w >> 8) << 16)
+				| (((c >>  8 & 0xff) * w >> 8) << 8)
+				|  ((c       & 0xff) * w >> 8);
+	}
+}
+
+// ---------------------------------------------------------------------------
+//	ワーカースレッドの用意
+//	用意できなかった分は呼び出し元のスレッドで処理する
+//
+bool Scaler::StartWorkers()
+{
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	int n = Min(int(si.dwNumberOfProcessors) - 1, maxworkers);
+
+	shouldterminate = false;
+	for (nworkers=0; nworkers<n; nworkers++)
+	{
+		Worker& w = worker[nworkers];
+		w.scaler = this;
+		w.hstart = CreateEvent(NULL, FALSE, FALSE, NULL);
+		w.hdone = CreateEvent(NULL, FALSE, FALSE, NULL);
+		w.hthread = 0;
+		if (w.hstart && w.hdone)
+			w.hthread = HANDLE(_beginthreadex(NULL, 0, ThreadEntry,
+							   reinterpret_cast<void*> (&w), 0, &w.idthread));
+		if (!w.hthread)
+		{
+			if (w.hstart) CloseHandle(w.hstart);
+			if (w.hdone) CloseHandle(w.hdone);
+			break;
+		}
+	}
+	LOG1("workers: %d\n", nworkers);
+	return nworkers == n;
+}
+
+// ---------------------------------------------------------------------------
+//	ワーカースレッドの終了
+//
+void Scaler::StopWorkers()
+{
+	shouldterminate = true;
+	for (int i=0; i<nworkers; i++)
+		SetEvent(worker[i].hstart);
+	for (int i=0; i<nworkers; i++)
+	{
+		Worker& w = worker[i];
+		if (WAIT_TIMEOUT == WaitForSingleObject(w.hthread, 3000))
+			TerminateThread(w.hthread, 0);
+		CloseHandle(w.hthread);
+		CloseHandle(w.hstart);
+		CloseHandle(w.hdone);
+	}
+	nworkers = 0;
+}
+
+// ---------------------------------------------------------------------------
+//	ワーカースレッド
+//
+uint Scaler::ThreadMain(Worker* w)
+{
+	for (;;)
+	{
+		WaitForSingleObject(w->hstart, INFINITE);
+		if (shouldterminate)
+			break;
+		ConvertBand(w->top, w->bottom);
+		SetEvent(w->hdone);
+	}
+	return 0;
+}
+
+uint __stdcall Scaler::ThreadEntry(LPVOID arg)
+{
+	if (arg)
+	{
+		Worker* w = reinterpret_cast<Worker*> (arg);
+		return w->scaler->ThreadMain(w);
+	}
+	return 0;
+}
@@ -0,0 +1,98 @@
+﻿// ---------------------------------------------------------------------------
+//	M88 - PC-8801 Emulator.
+// ---------------------------------------------------------------------------
+//	画面の拡大
+// ---------------------------------------------------------------------------
+
+#pragma once
+
+#include "types.h"
+
+// ---------------------------------------------------------------------------
+//	Scaler
+//
+//	8bpp の画面イメージを 2/3/4 倍に拡大した 32bpp (BGRA) の DIB を作る．
+//	ウィンドウへの転送を GPU/ドライバの拡大に任せると画素がぼやけるので，
+//	整数倍に拡大してから 1:1 で転送する．
+//	スキャンライン (各画素の下側の行を暗くする) とアパーチャグリル
+//	(出力の列ごとに RGB のどれかを強調する) の効果を付けられる．
+//	効果は色テーブルに織り込み，帯ごとのパレットもテーブルを切り替えて扱う．
+//	拡大は更新範囲のラインだけを行い，範囲が大きい時は横方向の帯に分けて
+//	ワーカースレッドで並列に処理する．
+//
+class Scaler
+{
+public:
+	enum Mask
+	{
+		scanline = 1 << 0,			// スキャンライン
+		aperture = 1 << 1,			// アパーチャグリル
+	};
+	enum
+	{
+		maxscale = 4,
+		maxbands = 16,
+		maxworkers = 3,				// 呼び出し元のスレッドも 1 帯受け持つ
+		minrows = 32,				// 1 帯あたりの最小ライン数
+	};
+
+public:
+	Scaler();
+	~Scaler();
+
+	bool Init(HWND hwnd, uint width, uint height, uint scale, uint mask);
+	void Cleanup();
+
+	bool IsEnabled() { return hbitmap != 0; }
+	uint GetScale() { return hbitmap ? scale : 1; }
+	uint GetMask() { return mask; }
+
+	void SetPalette(int nbands, const int* top, const RGBQUAD* colors);
+	void Update(const uint8* src, int bpl, const RECT& rect);
+	void Blt(HDC hdc, const RECT& rect);
+
+private:
+	struct Worker
+	{
+		Scaler* scaler;
+		HANDLE hthread;
+		HANDLE hstart;
+		HANDLE hdone;
+		uint idthread;
+		int top;
+		int bottom;
+	};
+
+	void BuildTable(uint32 (*table)[256], const RGBQUAD* colors);
+	void ConvertBand(int top, int bottom);
+	void ExpandLine(uint32* dest, const uint8* src, int n, const uint32 (*table)[256]);
+	static void CopyLine(uint32* dest, const uint32* src, int n, int weight);
+
+	bool StartWorkers();
+	void StopWorkers();
+	uint ThreadMain(Worker* w);
+	static uint __stdcall ThreadEntry(LPVOID arg);
+
+	HBITMAP hbitmap;
+	uint32* image;					// 拡大後のイメージ (top-down)
+	int dbpl;						// 1 ラインの画素数
+	uint width;						// 元の画面の大きさ
+	uint height;
+	uint scale;
+	uint mask;
+
+	int nbands;						// 帯の数 (最低 1)
+	int bandtop[maxbands];
+	uint32 table[maxbands][3][256];	// 帯・アパーチャの位相ごとの色
+	int weight[maxscale];			// 拡大後の各行の明るさ (256 = 1.0)
+
+	// 変換中のジョブ
+	const uint8* jobsrc;
+	int jobbpl;
+	int jobleft;
+	int jobright;
+
+	int nworkers;
+	Worker worker[maxworkers];
+	volatile bool shouldterminate;
+};
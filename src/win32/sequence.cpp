@@ -38,11 +38,16 @@ bool Sequencer::Init(PC88* _vm)
 	clock = 1;
 	speed = 100;
 
-	drawnextframe = false;
 	skippedframe = 0;
 	refreshtiming = 1;
 	refreshcount = 0;
 
+	staleframes = 0;
+	costrate = 0;
+	renderedframes = 0;
+	identicalframes = 0;
+	droppedframes = 0;
+
 	if (!hthread)
 	{
 		hthread = (HANDLE) 
@@ -147,25 +152,23 @@ void Sequencer::ExecuteAsynchronus()
 		int32 tcpu = keeper.GetTime() - time;
 		if (tcpu < twork)
 		{
-			if (drawnextframe && ++refreshcount >= refreshtiming)
+			// 残り時間で合成が終わりそうなら合成する
+			if (++refreshcount >= refreshtiming)
 			{
-				vm->UpdateScreen();
-				skippedframe = 0;
-				refreshcount = 0;
+				if (UpdateScreen(twork - tcpu, false) != dropped)
+				{
+					skippedframe = 0;
+					refreshcount = 0;
+				}
 			}
 
 			int32 tdraw = keeper.GetTime() - time;
 			
-			if (tdraw > twork)
-			{
-				drawnextframe = false;
-			}
-			else
+			if (tdraw < twork)
 			{
 				int it = (twork - tdraw) / 100;
 				if (it > 0)
 					Sleep(it);
-				drawnextframe = true;
 			}
 			time += twork;
 		}
@@ -174,14 +177,67 @@ void Sequencer::ExecuteAsynchronus()
 			time += twork;
 			if (++skippedframe >= 20)
 			{
-				vm->UpdateScreen();
+				UpdateScreen(0, true);
 				skippedframe = 0;
 				time = keeper.GetTime();
 			}
+			else
+			{
+				UpdateScreen(0, false);
+			}
 		}
 	}
 }
 
+// ---------------------------------------------------------------------------
+//	画面更新
+//	画面に変化がなければ合成を省く．
+//	変化量と最近のフレームの合成時間から合成にかかる時間を予測し，
+//	budget (TimeKeeper の単位) に収まらなければそのフレームを落とす．
+//	落としたフレームの変化は VM 側に残るので次に合成するフレームに含まれる．
+//	force が true か，落としたフレームが続いた場合は必ず合成する
+//
+Sequencer::FrameResult Sequencer::UpdateScreen(int32 budget, bool force)
+{
+	uint work = vm->GetScreenChanges();
+	if (!work)
+	{
+		identicalframes++;
+		staleframes = 0;
+		return identical;
+	}
+
+	work += costoverhead;
+	int32 predict = int32((int64(costrate) * work) >> 12);
+	if (!force && staleframes < maxstaleframes && predict > budget)
+	{
+		droppedframes++;
+		staleframes++;
+		return dropped;
+	}
+
+	uint32 tstart = keeper.GetTime();
+	vm->UpdateScreen();
+	int32 cost = keeper.GetTime() - tstart;
+
+	// 変化量あたりの合成時間を移動平均で更新
+	costrate += (int32((int64(cost) << 12) / work) - costrate) / 4;
+
+	staleframes = 0;
+	renderedframes++;
+	return rendered;
+}
+
+// ---------------------------------------------------------------------------
+//	合成した・変化がなく省いた・落としたフレームの数を返し，カウンタをリセット
+//
+void Sequencer::GetFrameCounts(uint* r, uint* i, uint* d)
+{
+	*r = renderedframes, renderedframes = 0;
+	*i = identicalframes, identicalframes = 0;
+	*d = droppedframes, droppedframes = 0;
+}
+
 // ---------------------------------------------------------------------------
 //	実行クロックカウントの値を返し、カウンタをリセット
 //
@@ -39,9 +39,24 @@ public:
 	void SetSpeed(int spd);
 	void SetRefreshTiming(uint rti);
 
+	void GetFrameCounts(uint* rendered, uint* identical, uint* dropped);
+
 private:
+	enum FrameResult
+	{
+		dropped = 0,			// 変化はあったが合成しなかった
+		identical,				// 変化がないので合成を省いた
+		rendered,				// 合成した
+	};
+	enum
+	{
+		maxstaleframes = 20,	// 続けて落としてよいフレーム数
+		costoverhead = 32,		// 合成 1 回の固定の手間 (GVRAM ブロック換算)
+	};
+
 	void Execute(long clock, long length, long ec);
 	void ExecuteAsynchronus();
+	FrameResult UpdateScreen(int32 budget, bool force);
 	
 	uint ThreadMain();
 	static uint CALLBACK ThreadEntry(LPVOID arg);
@@ -63,7 +78,12 @@ private:
 	uint skippedframe;
 	uint refreshcount;
 	uint refreshtiming;
-	bool drawnextframe;
+
+	uint staleframes;			// 変化があるのに合成していないフレーム数
+	int32 costrate;				// 変化量 1 あたりの合成時間の予測 (1/4096)
+	uint renderedframes;
+	uint identicalframes;
+	uint droppedframes;
 	
 	volatile bool shouldterminate;
 	volatile bool active;
@@ -17,6 +17,7 @@ typedef unsigned long ulong;
 typedef unsigned char uint8;
 typedef unsigned short uint16;
 typedef unsigned int  uint32;
+typedef unsigned long long uint64;
 
 typedef signed char sint8;
 typedef signed short sint16;
@@ -25,6 +26,7 @@ typedef signed int sint32;
 typedef signed char int8;
 typedef signed short int16;
 typedef signed int int32;
+typedef signed long long int64;
 
 // 8 bit 数値をまとめて処理するときに使う型
 typedef uint32 packed;
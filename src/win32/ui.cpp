@@ -24,6 +24,7 @@
 #include "filetest.h"
 #include "winvars.h"
 #include "winexapi.h"
+#include "scaler.h"
 
 #define LOGNAME "ui"
 #include "diag.h"
@@ -675,6 +676,22 @@ LRESULT WinUI::WmCommand(HWND hwnd, WPARAM wparam, LPARAM lparam)
 		}
 		break;
 
+	case IDM_RECORDVIDEO:
+		if (!core.GetRecorder()->IsRecording())
+		{
+			char buf[16];
+			SYSTEMTIME t;
+
+			GetLocalTime(&t);
+			wsprintf(buf, "%.2d%.2d%.2d%.2d.m8v", t.wDay, t.wHour, t.wMinute, t.wSecond);
+			core.GetRecorder()->Start(buf);
+		}
+		else
+		{
+			core.GetRecorder()->Stop();
+		}
+		break;
+
 	case IDM_SNAPSHOT_SAVE:
 		SaveSnapshot(currentsnapshot);
 		break;
@@ -821,16 +838,23 @@ LRESULT WinUI::WmTimer(HWND hwnd, WPARAM wparam, LPARAM lparam)
 		// 実効周波数,表示フレーム数を取得
 		int	fcount = draw.GetDrawCount();
 		int	icount = core.GetExecCount();
+		uint rendered, identical, dropped;
+		core.GetFrameCounts(&rendered, &identical, &dropped);
+		LOG3("rendered: %d  identical: %d  dropped: %d\n", rendered, identical, dropped);
 		
 		// レポートする場合はタイトルバーを更新
 		if (report)
 		{
 			if (active)
 			{
-				char buf[64];
+				char buf[80];
 				uint freq = icount / 10000;
-				wsprintf(buf, "M88 - %d fps.  %d.%.2d MHz", 
-					fcount, freq / 100, freq % 100);
+				if (dropped)
+					wsprintf(buf, "M88 - %d fps (%d dropped).  %d.%.2d MHz", 
+						fcount, dropped, freq / 100, freq % 100);
+				else
+					wsprintf(buf, "M88 - %d fps.  %d.%.2d MHz", 
+						fcount, freq / 100, freq % 100);
 				SetWindowText(hwnd, buf);
 			}
 			else
@@ -896,6 +920,7 @@ LRESULT WinUI::WmInitMenu(HWND hwnd, WPARAM wp, LPARAM lp)
 	CheckMenuItem(hmenu, IDM_LOADMON, loadmon.IsOpen() ? MF_CHECKED : MF_UNCHECKED);
 	CheckMenuItem(hmenu, IDM_IOMON, iomon.IsOpen() ? MF_CHECKED : MF_UNCHECKED);
 	CheckMenuItem(hmenu, IDM_RECORDPCM, core.GetSound()->IsDumping() ? MF_CHECKED : MF_UNCHECKED);
+	CheckMenuItem(hmenu, IDM_RECORDVIDEO, core.GetRecorder()->IsRecording() ? MF_CHECKED : MF_UNCHECKED);
 	
 	EnableMenuItem(hmenu, IDM_DUMPCPU1, core.GetCPU1()->GetDumpState() == -1 ? MF_GRAYED : MF_ENABLED);
 	CheckMenuItem(hmenu, IDM_DUMPCPU1, core.GetCPU1()->GetDumpState() == 1 ? MF_CHECKED : MF_UNCHECKED);
@@ -977,6 +1002,11 @@ void WinUI::ApplyConfig()
 	keyif.ApplyConfig(&config);
 	draw.SetPriorityLow((config.flags & Config::drawprioritylow) != 0);
 
+	uint scalemask = (config.flag2 & Config::scalescanline ? Scaler::scanline : 0)
+				   | (config.flag2 & Config::scaleaperture ? Scaler::aperture : 0);
+	if (draw.SetScaleMode(config.scale, scalemask) && !fullscreen)
+		ResizeWindow(640, 400);
+
 	MENUITEMINFO mii;
 	memset(&mii, 0, sizeof(mii));
 	mii.cbSize = WINVAR(MIISIZE);
@@ -1340,17 +1370,19 @@ void WinUI::OpenTapeImage(const char* filename)
 // ---------------------------------------------------------------------------
 //	WinUI::ResizeWindow
 //	ウィンドウの大きさを変える
+//	width, height は画面の大きさで，拡大する場合はその分大きくする
 //
 void WinUI::ResizeWindow(uint width, uint height)
 {
+	uint scale = draw.GetScale();
 	RECT rect;
-	rect.left = 0;	rect.right = width;
-	rect.top  = 0;  rect.bottom = height + statusdisplay.GetHeight();
+	rect.left = 0;	rect.right = width * scale;
+	rect.top  = 0;  rect.bottom = height * scale + statusdisplay.GetHeight();
 
 	AdjustWindowRectEx(&rect, wstyle, TRUE, 0);
 	SetWindowPos(hwnd, 0, 0, 0, rect.right-rect.left, rect.bottom-rect.top,
 				 SWP_NOMOVE | SWP_NOZORDER | SWP_NOACTIVATE);
-	PostMessage(hwnd, WM_SIZE, SIZE_RESTORED, MAKELONG(width, height));
+	PostMessage(hwnd, WM_SIZE, SIZE_RESTORED, MAKELONG(width * scale, height * scale));
 	draw.Resize( width, height );
 }
 
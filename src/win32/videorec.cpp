@@ -0,0 +1,509 @@
+﻿// ---------------------------------------------------------------------------
+//	M88 - PC-8801 Emulator.
+// ---------------------------------------------------------------------------
+//	画面の録画
+// ---------------------------------------------------------------------------
+
+#include "headers.h"
+#include "videorec.h"
+#include "misc.h"
+#include "status.h"
+#include "zlib/zlib.h"
+
+#define LOGNAME "videorec"
+#include "diag.h"
+
+#define CHUNKID(a, b, c, d)	((a) | ((b) << 8) | ((c) << 16) | ((d) << 24))
+
+static inline void PutLE16(uint8* p, uint v)
+{
+	p[0] = uint8(v), p[1] = uint8(v >> 8);
+}
+
+static inline void PutLE32(uint8* p, uint32 v)
+{
+	p[0] = uint8(v), p[1] = uint8(v >> 8), p[2] = uint8(v >> 16), p[3] = uint8(v >> 24);
+}
+
+// ---------------------------------------------------------------------------
+//	構築/消滅
+//
+VideoRecorder::VideoRecorder()
+: draw(0), prev(0), work(0), nbands(0), palchanged(true), pending(false),
+  frame(0), keyframe(0), head(0), tail(0), queued(0), recording(false),
+  sample(0), rate(0), channels(0), frames(0), dropped(0), droppedsamples(0),
+  hthread(0), idthread(0), hevent(0), shouldterminate(false)
+{
+	memset(palette, 0, sizeof(palette));
+}
+
+VideoRecorder::~VideoRecorder()
+{
+	Stop();
+}
+
+// ---------------------------------------------------------------------------
+//	録画開始
+//
+bool VideoRecorder::Start(const char* filename)
+{
+	if (recording)
+		return false;
+
+	CriticalSection::Lock lock(csframe);
+	prev = new uint8[scrnwidth * scrnheight];
+	work = new uint8[scrnheight * (scrnwidth + 6) + 2];
+	if (!prev || !work || !file.Open(filename, FileIO::create))
+	{
+		delete[] prev;	prev = 0;
+		delete[] work;	work = 0;
+		return false;
+	}
+
+	index.clear();
+	rate = 0;
+	channels = 0;
+	sample = 0;
+	frames = 0;
+	dropped = 0;
+	droppedsamples = 0;
+	WriteHeader(0);
+
+	// 最初のフレームは画面全体を送る
+	pending = true;
+	pendtop = 0;
+	pendbottom = scrnheight - 1;
+	pendframe = frame;
+	pendsample = 0;
+	keyframe = frame;
+	palchanged = true;
+
+	shouldterminate = false;
+	hevent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	hthread = HANDLE(_beginthreadex(NULL, 0, ThreadEntry,
+					   reinterpret_cast<void*> (this), 0, &idthread));
+	if (!hevent || !hthread)
+	{
+		if (hevent)
+			CloseHandle(hevent), hevent = 0;
+		file.Close();
+		delete[] prev;	prev = 0;
+		delete[] work;	work = 0;
+		return false;
+	}
+	SetThreadPriority(hthread, THREAD_PRIORITY_BELOW_NORMAL);
+	recording = true;
+	statusdisplay.Show(100, 2500, "録画開始");
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+//	録画終了
+//	溜まっているパケットを書き終えてから索引を書き込む
+//
+bool VideoRecorder::Stop()
+{
+	if (!recording)
+		return false;
+	{
+		CriticalSection::Lock lock(csframe);
+		recording = false;
+	}
+
+	if (hthread)
+	{
+		int i = 1000;
+		do
+		{
+			shouldterminate = true;
+			SetEvent(hevent);
+		} while (--i > 0 && WAIT_TIMEOUT == WaitForSingleObject(hthread, 10));
+
+		if (!i)
+			TerminateThread(hthread, 0);
+
+		CloseHandle(hthread), hthread = 0;
+	}
+	if (hevent)
+		CloseHandle(hevent), hevent = 0;
+
+	// 書き出せなかったパケットを捨てる
+	while (head)
+	{
+		Packet* p = head;
+		head = p->next;
+		delete[] (uint8*) p;
+	}
+	tail = 0;
+	queued = 0;
+
+	// 索引
+	file.Seek(0, FileIO::end);
+	uint32 indexoffset = file.Tellp();
+	uint8 hdr[8];
+	PutLE32(hdr, CHUNKID('I', 'N', 'D', 'X'));
+	PutLE32(hdr + 4, index.size() * 12);
+	file.Write(hdr, 8);
+	for (uint i=0; i<index.size(); i++)
+	{
+		uint8 e[12];
+		PutLE32(e,     index[i].frame);
+		PutLE32(e + 4, index[i].sample);
+		PutLE32(e + 8, index[i].offset);
+		file.Write(e, 12);
+	}
+	WriteHeader(indexoffset);
+	file.Close();
+
+	delete[] prev;	prev = 0;
+	delete[] work;	work = 0;
+
+	LOG3("frames: %d  dropped: %d  dropped samples: %d\n", frames, dropped, droppedsamples);
+	statusdisplay.Show(100, 2500, "録画終了 (%d フレーム，欠落 %d)", frames, dropped);
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+//	ファイルの先頭
+//
+void VideoRecorder::WriteHeader(uint32 indexoffset)
+{
+	uint8 hdr[32];
+	memcpy(hdr, "M88VIDEO", 8);
+	PutLE32(hdr +  8, 1);
+	PutLE16(hdr + 12, scrnwidth);
+	PutLE16(hdr + 14, scrnheight);
+	PutLE32(hdr + 16, rate);
+	PutLE16(hdr + 20, channels);
+	PutLE16(hdr + 22, 0);
+	PutLE32(hdr + 24, indexoffset);
+	PutLE32(hdr + 28, frames);
+
+	file.Seek(0, FileIO::begin);
+	file.Write(hdr, sizeof(hdr));
+}
+
+// ---------------------------------------------------------------------------
+//	画面イメージの使用要求
+//	前のフレームで更新された部分をここで取り出す
+//
+bool VideoRecorder::Lock(uint8** pimage, int* pbpl)
+{
+	if (!draw->Lock(pimage, pbpl))
+		return false;
+	if (pending)
+	{
+		CriticalSection::Lock lock(csframe);
+		if (recording && pending)
+			Encode(*pimage, *pbpl);
+	}
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+//	画面の表示
+//	更新範囲を記録しておき，次の Lock で取り出す
+//
+void VideoRecorder::DrawScreen(const Region& region)
+{
+	if (recording)
+	{
+		CriticalSection::Lock lock(csframe);
+		if (recording && (region.top <= region.bottom || palchanged))
+		{
+			if (!pending)
+			{
+				pending = true;
+				pendtop = scrnheight;
+				pendbottom = -1;
+			}
+			pendtop = Min(pendtop, Max(0, region.top));
+			pendbottom = Max(pendbottom, Min(scrnheight - 1, region.bottom));
+			pendframe = frame;
+			pendsample = sample;
+		}
+	}
+	frame++;
+	draw->DrawScreen(region);
+}
+
+// ---------------------------------------------------------------------------
+//	パレット
+//
+void VideoRecorder::SetPalette(uint index, uint nents, const Palette* pal)
+{
+	memcpy(palette + index, pal, nents * sizeof(Palette));
+	palchanged = true;
+	draw->SetPalette(index, nents, pal);
+}
+
+bool VideoRecorder::SetRasterPalette(uint n, const int* top, uint index, uint nents, const Palette* pal)
+{
+	if (n <= maxbands)
+	{
+		for (uint i=0; i<n; i++)
+		{
+			bandtop[i] = top[i];
+			memcpy(bandpal[i], palette, sizeof(palette));
+			memcpy(bandpal[i] + index, pal + i * nents, nents * sizeof(Palette));
+		}
+		nbands = n;
+		palchanged = true;
+	}
+	return draw->SetRasterPalette(n, top, index, nents, pal);
+}
+
+// ---------------------------------------------------------------------------
+//	前に送ったフレームとの差分を作ってパケットにする
+//	ラインごとに変化した範囲 (最初と最後の変化の間) を送る
+//
+void VideoRecorder::Encode(const uint8* image, int bpl)
+{
+	bool key = int32(pendframe - keyframe) >= 0;
+	int top = key ? 0 : pendtop;
+	int bottom = key ? scrnheight - 1 : pendbottom;
+	bool haspal = palchanged || key;
+
+	uint estimate = key ? scrnwidth * scrnheight : Max(0, bottom - top + 1) * (scrnwidth + 6);
+	{
+		CriticalSection::Lock lock(cs);
+		if (queued + estimate > maxqueued)
+		{
+			// 書き出しが追いついていない．更新範囲は次のフレームにまとめる
+			dropped++;
+			return;
+		}
+	}
+
+	uint8* w = work;
+	int y;
+	if (key)
+	{
+		for (y=0; y<scrnheight; y++, w+=scrnwidth)
+			memcpy(w, image + y * bpl, scrnwidth);
+	}
+	else
+	{
+		for (y=top; y<=bottom; y++)
+		{
+			const uint8* s = image + y * bpl;
+			const uint8* p = prev + y * scrnwidth;
+			int x0, x1;
+			for (x0=0; x0<scrnwidth && s[x0] == p[x0]; x0++)
+				;
+			if (x0 == scrnwidth)
+				continue;
+			for (x1=scrnwidth; s[x1-1] == p[x1-1]; x1--)
+				;
+			PutLE16(w,     y);
+			PutLE16(w + 2, x0);
+			PutLE16(w + 4, x1 - x0);
+			memcpy(w + 6, s + x0, x1 - x0);
+			w += 6 + x1 - x0;
+		}
+		PutLE16(w, 0xffff);
+		w += 2;
+		if (w - work == 2 && !haspal)
+		{
+			pending = false;
+			return;
+		}
+	}
+	for (y=top; y<=bottom; y++)
+		memcpy(prev + y * scrnwidth, image + y * bpl, scrnwidth);
+
+	int n = nbands ? nbands : 1;
+	uint headsize = 9 + (haspal ? 1 + n * (2 + 0x100 * 3) : 0);
+	uint bodysize = w - work;
+	Packet* pk = AllocPacket(CHUNKID('F', 'R', 'A', 'M'), headsize + bodysize);
+	if (!pk)
+	{
+		dropped++;
+		return;
+	}
+
+	uint8* d = pk->data;
+	PutLE32(d,     pendframe);
+	PutLE32(d + 4, pendsample);
+	d[8] = (key ? 1 : 0) | (haspal ? 2 : 0);
+	d += 9;
+	if (haspal)
+	{
+		*d++ = n;
+		int i;
+		for (i=0; i<n; i++, d+=2)
+			PutLE16(d, nbands ? bandtop[i] : 0);
+		for (i=0; i<n; i++)
+		{
+			const Palette* pal = nbands ? bandpal[i] : palette;
+			for (int c=0; c<0x100; c++, d+=3)
+				d[0] = pal[c].red, d[1] = pal[c].green, d[2] = pal[c].blue;
+		}
+	}
+	memcpy(d, work, bodysize);
+
+	pk->head = headsize;
+	pk->key = key;
+	pk->frame = pendframe;
+	pk->sample = pendsample;
+	Push(pk);
+
+	if (key)
+		keyframe = pendframe + keyinterval;
+	pending = false;
+	palchanged = false;
+}
+
+// ---------------------------------------------------------------------------
+//	音声
+//	音の出力スレッドから呼ばれる
+//
+void VideoRecorder::PutAudio(const Sample* src, int samples, int ch, uint r)
+{
+	if (!recording || samples <= 0)
+		return;
+
+	CriticalSection::Lock lock(csframe);
+	if (!recording)
+		return;
+	if (!rate)
+		rate = r, channels = ch;
+
+	uint size = 4 + samples * ch * sizeof(Sample);
+	bool full;
+	{
+		CriticalSection::Lock lock(cs);
+		full = queued + size > maxqueued;
+	}
+	Packet* pk = full ? 0 : AllocPacket(CHUNKID('A', 'U', 'D', 'I'), size);
+	if (pk)
+	{
+		PutLE32(pk->data, sample);
+		memcpy(pk->data + 4, src, size - 4);
+		pk->head = size;
+		Push(pk);
+	}
+	else
+		droppedsamples += samples;
+	sample += samples;
+}
+
+// ---------------------------------------------------------------------------
+//	パケット
+//
+VideoRecorder::Packet* VideoRecorder::AllocPacket(uint32 id, uint size)
+{
+	Packet* p = (Packet*) new uint8[sizeof(Packet) + size];
+	if (p)
+	{
+		p->next = 0;
+		p->id = id;
+		p->size = size;
+		p->head = size;
+		p->key = false;
+		p->frame = 0;
+		p->sample = 0;
+	}
+	return p;
+}
+
+void VideoRecorder::Push(Packet* p)
+{
+	{
+		CriticalSection::Lock lock(cs);
+		if (tail)
+			tail->next = p;
+		else
+			head = p;
+		tail = p;
+		queued += p->size;
+	}
+	SetEvent(hevent);
+}
+
+// ---------------------------------------------------------------------------
+//	パケットの書き出し
+//	head 以降の部分を圧縮する
+//
+void VideoRecorder::WritePacket(Packet* p)
+{
+	const uint8* data = p->data;
+	uint size = p->size;
+	uint8* z = 0;
+	if (p->head < p->size)
+	{
+		uLong zsize = compressBound(p->size - p->head);
+		z = new uint8[p->head + zsize];
+		if (!z || Z_OK != compress2(z + p->head, &zsize, p->data + p->head, p->size - p->head, Z_BEST_SPEED))
+		{
+			LOG0("compress failed\n");
+			delete[] z;
+			return;
+		}
+		memcpy(z, p->data, p->head);
+		data = z;
+		size = p->head + zsize;
+	}
+
+	uint32 offset = file.Tellp();
+	uint8 hdr[8];
+	PutLE32(hdr, p->id);
+	PutLE32(hdr + 4, size);
+	file.Write(hdr, 8);
+	file.Write(data, size);
+	delete[] z;
+
+	if (p->id == CHUNKID('F', 'R', 'A', 'M'))
+	{
+		frames++;
+		if (p->key)
+		{
+			IndexEntry e = { p->frame, p->sample, offset };
+			index.push_back(e);
+		}
+	}
+}
+
+// ---------------------------------------------------------------------------
+//	書き出しスレッド
+//	終了要求があっても溜まっているパケットはすべて書き出す
+//
+uint VideoRecorder::ThreadMain()
+{
+	for (;;)
+	{
+		Packet* p;
+		{
+			CriticalSection::Lock lock(cs);
+			p = head;
+			if (p)
+			{
+				head = p->next;
+				if (!head)
+					tail = 0;
+			}
+		}
+		if (p)
+		{
+			WritePacket(p);
+			{
+				CriticalSection::Lock lock(cs);
+				queued -= p->size;
+			}
+			delete[] (uint8*) p;
+			continue;
+		}
+		if (shouldterminate)
+			break;
+		WaitForSingleObject(hevent, 1000);
+	}
+	return 0;
+}
+
+uint __stdcall VideoRecorder::ThreadEntry(LPVOID arg)
+{
+	if (arg)
+		return reinterpret_cast<VideoRecorder*> (arg)->ThreadMain();
+	else
+		return 0;
+}
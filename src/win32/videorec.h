@@ -0,0 +1,144 @@
+﻿// ---------------------------------------------------------------------------
+//	M88 - PC-8801 Emulator.
+// ---------------------------------------------------------------------------
+//	画面の録画
+// ---------------------------------------------------------------------------
+
+#pragma once
+
+#include "types.h"
+#include "draw.h"
+#include "critsect.h"
+#include "file.h"
+#include "soundsrc.h"
+
+// ---------------------------------------------------------------------------
+//	VideoRecorder
+//
+//	PC88 と実際の Draw の間に入り，更新された画面を録画する．
+//	DrawScreen で渡された更新範囲のラインだけを前のフレームと比較し，
+//	変化した部分をパケットにして書き出しスレッドに渡す．
+//	圧縮 (zlib) とファイルへの書き込みは書き出しスレッドで行う．
+//	画面イメージに触れられるのは Lock 中だけなので，差分の取り出しは
+//	次のフレームの Lock の時に行う．
+//	溜まっているパケットが maxqueued を超えたらフレームを捨てて数える．
+//	捨てたフレームの更新範囲は次のフレームにまとめる．
+//
+//	ファイル形式 (little endian)
+//	header	"M88VIDEO", version, width(2), height(2), rate, channels(2),
+//			reserved(2), index offset, frames
+//	chunk	id(4), size(4), data
+//	 "FRAM"	frame, sample, flags(1) [palette] zlib(data)
+//			flags: b0 key frame (data = 全画面), b1 palette
+//			palette: nbands(1), top(2) * nbands, RGB * 256 * nbands
+//			data (差分): { y(2), x(2), len(2), pixels } ... 0xffff
+//	 "AUDI"	sample, PCM (16bit)
+//	 "INDX"	{ frame, sample, offset } (key frame ごと)
+//	sample はフレームを表示した時点までに録音したサンプル数で，
+//	画面と音の時間軸を合わせるのに使う．
+//
+class VideoRecorder : public Draw
+{
+public:
+	enum
+	{
+		maxqueued = 16 * 1024 * 1024,	// 溜められるパケットの大きさ
+		keyinterval = 300,				// key frame の間隔
+		maxbands = 16,
+	};
+
+public:
+	VideoRecorder();
+	~VideoRecorder();
+
+	void SetDraw(Draw* d) { draw = d; }
+
+	bool Start(const char* filename);
+	bool Stop();
+	bool IsRecording() { return recording; }
+	uint GetDroppedCount() { return dropped; }
+
+	void PutAudio(const Sample* src, int samples, int channels, uint rate);
+
+// - Draw Common Interface
+	bool Init(uint width, uint height, uint bpp) { return draw->Init(width, height, bpp); }
+	bool Cleanup() { return draw->Cleanup(); }
+	bool Lock(uint8** pimage, int* pbpl);
+	bool Unlock() { return draw->Unlock(); }
+	uint GetStatus() { return draw->GetStatus(); }
+	void Resize(uint width, uint height) { draw->Resize(width, height); }
+	void DrawScreen(const Region& region);
+	void SetPalette(uint index, uint nents, const Palette* pal);
+	bool SetRasterPalette(uint nbands, const int* top, uint index, uint nents, const Palette* pal);
+	void Flip() { draw->Flip(); }
+	bool SetFlipMode(bool f) { return draw->SetFlipMode(f); }
+
+private:
+	struct Packet
+	{
+		Packet* next;
+		uint32 id;
+		uint size;		// data の大きさ
+		uint head;		// data のうち圧縮しない部分の大きさ
+		uint32 frame;	// key frame なら索引に加える
+		uint32 sample;
+		bool key;
+		uint8 data[1];
+	};
+	struct IndexEntry
+	{
+		uint32 frame;
+		uint32 sample;
+		uint32 offset;
+	};
+
+	void Encode(const uint8* image, int bpl);
+	Packet* AllocPacket(uint32 id, uint size);
+	void Push(Packet* packet);
+	void WritePacket(Packet* packet);
+	void WriteHeader(uint32 indexoffset);
+
+	uint ThreadMain();
+	static uint __stdcall ThreadEntry(LPVOID arg);
+
+	Draw* draw;
+
+	// 画面 (合成を行うスレッドのみが触る)
+	enum { scrnwidth = 640, scrnheight = 400 };
+	uint8* prev;					// 最後に送ったフレーム
+	uint8* work;
+	Palette palette[0x100];
+	int nbands;
+	int bandtop[maxbands];
+	Palette bandpal[maxbands][0x100];
+	bool palchanged;
+	bool pending;					// 差分を取り出していない更新がある
+	int pendtop, pendbottom;		// 取り出していない更新範囲
+	uint32 pendframe;
+	uint32 pendsample;
+	uint32 frame;					// DrawScreen の回数
+	uint32 keyframe;				// 次に key frame にするフレーム
+	CriticalSection csframe;
+
+	// 書き出し
+	FileIO file;
+	vector<IndexEntry> index;
+	Packet* head;
+	Packet* tail;
+	uint queued;					// 溜まっているパケットの大きさ
+	CriticalSection cs;
+
+	volatile bool recording;
+	volatile uint32 sample;			// 録音したサンプル数
+	uint rate;
+	int channels;
+	uint32 frames;					// 書き出したフレーム数
+	uint dropped;					// 捨てたフレーム数
+	uint droppedsamples;			// 捨てたサンプル数
+
+	HANDLE hthread;
+	uint idthread;
+	HANDLE hevent;
+	volatile bool shouldterminate;
+};
+
@@ -56,11 +56,14 @@ bool WinCore::Init
 	ui = _ui;
 	cfgprop = cp;
 
-	if (!PC88::Init(draw, disk, tape))
+	// 画面は録画用の Draw を通して描く
+	recorder.SetDraw(draw);
+	if (!PC88::Init(&recorder, disk, tape))
 		return false;
 
 	if (!sound.Init(this, hwnd, 0, 0))
 		return false;
+	sound.SetVideoRecorder(&recorder);
 
 	padif.Init();
 
@@ -85,6 +88,8 @@ bool WinCore::Init
 bool WinCore::Cleanup()
 {
 	seq.Cleanup();
+	PC88::ReleaseScreenPipe();
+	recorder.Stop();
 	
 	for (ExtendModules::iterator i = extmodules.begin(); i != extmodules.end(); ++i)
 		delete *i;
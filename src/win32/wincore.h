@@ -15,6 +15,7 @@
 #include "winsound.h"
 #include "sequence.h"
 #include "winjoy.h"
+#include "videorec.h"
 
 namespace PC8801
 {
@@ -45,8 +46,10 @@ public:
 	bool LoadShapshot(const char* filename, const char* diskname = 0);
 
 	PC8801::WinSound* GetSound() { return &sound; }
+	VideoRecorder* GetRecorder() { return &recorder; }
 
 	long GetExecCount() { return seq.GetExecCount(); }
+	void GetFrameCounts(uint* r, uint* i, uint* d) { seq.GetFrameCounts(r, i, d); }
 	void Wait(bool dowait) { seq.Activate(!dowait); }
 	void* IFCALL QueryIF(REFIID iid);
 	void IFCALL Lock() { seq.Lock(); }
@@ -98,6 +101,7 @@ private:
 
 	PC8801::WinSound sound;
 	PC8801::Config config;
+	VideoRecorder recorder;
 
 	typedef vector<PC8801::ExternalDevice*> ExternalDevices;
 	ExternalDevices extdevices;
@@ -40,7 +40,10 @@ WinDraw::WinDraw()
 	refresh = false;
 	locked = false;
 	active = false;
-
+	rasterbands = 0;
+	rasterchanged = false;
+	scale = 1;
+	scalemask = 0;
 }
 
 WinDraw::~WinDraw()
@@ -219,6 +222,11 @@ void WinDraw::PaintWindow()
 			palcngbegin = 0x100;
 			palcngend = -1;
 		}
+		if (rasterchanged)
+		{
+			rasterchanged = false;
+			draw->SetRasterPalette(rasterbands, rastertop, rasterpal[0]);
+		}
 		draw->DrawScreen(rect, drawall);
 		drawall = false;
 		if (rect.left < rect.right && rect.top < rect.bottom)
@@ -246,6 +254,30 @@ void WinDraw::SetPalette(uint index, uint nents, const Palette* pal)
 	palcngend   = Max(palcngend,   index + nents - 1);
 }
 
+// ---------------------------------------------------------------------------
+//	帯ごとのパレットをセット
+//	top[i] 以降のラインに pal[i * nents] からのパレットを使う．
+//	nbands が 0 なら通常のパレットに戻す
+//
+bool WinDraw::SetRasterPalette(uint nbands, const int* top, uint index, uint nents, const Palette* pal)
+{
+	assert(index + nents <= 0x100);
+
+	// DIB に描画する方式でのみ帯ごとにカラーテーブルを切り替えられる
+	if (nbands > maxbands || (nbands && drawtype != GDI && drawtype != D2D))
+		return false;
+
+	for (uint i=0; i<nbands; i++)
+	{
+		rastertop[i] = top[i];
+		memcpy(rasterpal[i], palette, sizeof(palette));
+		memcpy(rasterpal[i] + index, pal + i * nents, nents * sizeof(Palette));
+	}
+	rasterbands = nbands;
+	rasterchanged = true;
+	return true;
+}
+
 // ---------------------------------------------------------------------------
 //	Lock
 //
@@ -373,6 +405,7 @@ bool WinDraw::ChangeDisplayMode(bool fullscreen, bool force480)
 		
 		if (newdraw)
 		{
+			newdraw->SetScaleMode(scale, scalemask);
 			newdraw->SetFlipMode(flipmode);
 			newdraw->SetGUIMode(false);
 		}
@@ -401,6 +434,26 @@ bool WinDraw::ChangeDisplayMode(bool fullscreen, bool force480)
 	return false;
 }
 
+// ---------------------------------------------------------------------------
+//	拡大率と効果の設定
+//	ウィンドウの大きさが変わる場合 true を返す
+//
+bool WinDraw::SetScaleMode(uint s, uint m)
+{
+	if (s == scale && m == scalemask)
+		return false;
+
+	uint old = GetScale();
+	scale = s, scalemask = m;
+	if (draw)
+	{
+		CriticalSection::Lock lock(csdraw);
+		draw->SetScaleMode(scale, scalemask);
+		drawall = true;
+	}
+	return GetScale() != old;
+}
+
 // ---------------------------------------------------------------------------
 //	現在の状態を得る
 //
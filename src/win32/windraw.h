@@ -24,6 +24,9 @@ public:
 	virtual bool Resize(uint width, uint height) { return false; }
 	virtual bool Cleanup() = 0;
 	virtual void SetPalette(PALETTEENTRY* pal, int index, int nentries) {}
+	virtual bool SetRasterPalette(int nbands, const int* top, const PALETTEENTRY* pal) { return false; }
+	virtual bool SetScaleMode(uint scale, uint mask) { return scale <= 1; }
+	virtual uint GetScale() { return 1; }
 	virtual void QueryNewPalette() {}
 	virtual void DrawScreen(const RECT& rect, bool refresh) = 0;
 
@@ -58,6 +61,7 @@ public:
 	
 	void Resize(uint width, uint height);
 	void SetPalette(uint index, uint nents, const Palette* pal);
+	bool SetRasterPalette(uint nbands, const int* top, uint index, uint nents, const Palette* pal);
 	void DrawScreen(const Region& region);
 
 	uint GetStatus();
@@ -73,6 +77,8 @@ public:
 	void SetPriorityLow(bool low);
 	void SetGUIFlag(bool flag);
 	bool ChangeDisplayMode(bool fullscreen, bool force480 = true);
+	bool SetScaleMode(uint scale, uint mask);
+	uint GetScale() { return draw ? draw->GetScale() : 1; }
 	void Refresh() { refresh = 1; }
 	void WindowMoved(int cx, int cy);
 
@@ -80,6 +86,7 @@ public:
 
 private:
 	enum DisplayType { None, GDI, DDWin, DDFull, D2D };
+	enum { maxbands = 16 };
 	void PaintWindow();
 
 	static BOOL WINAPI DDEnumCallback(GUID FAR* guid, LPSTR desc, LPSTR name, LPVOID context, HMONITOR hm);
@@ -117,10 +124,17 @@ private:
 	CriticalSection csdraw;
 	bool locked;
 	bool flipmode;
+	uint scale;						// 拡大率
+	uint scalemask;					// 拡大時の効果 (Scaler::Mask)
 
 	HMONITOR hmonitor;				// 探索中の hmonitor
 	GUID gmonitor;					// hmonitor に対応する GUID
 
 	PALETTEENTRY palette[0x100];
+
+	int rasterbands;				// 帯ごとのパレットの数 (0 なら使わない)
+	bool rasterchanged;				// 帯ごとのパレットが変更された
+	int rastertop[maxbands];		// 各帯の先頭ライン
+	PALETTEENTRY rasterpal[maxbands][0x100];
 };
 
@@ -13,6 +13,7 @@
 #include "soundds2.h"
 #include "soundwo.h"
 #include "soundmon.h"
+#include "videorec.h"
 
 //#define LOGNAME "winsound"
 #include "diag.h"
@@ -198,6 +199,7 @@ bool WinSound::DumpEnd()
 
 SoundDumpPipe::SoundDumpPipe()
 	: source_(0)
+	, recorder_(0)
 	, dumpstate_(IDLE)
 	, hmmio_(0)
 {
@@ -291,7 +293,12 @@ int SoundDumpPipe::Get(Sample* dest, int samples)
 		return 0;
 
 	if (dumpstate_ == IDLE)
-		return source_->Get(dest, samples);
+	{
+		int n = source_->Get(dest, samples);
+		if (recorder_)
+			recorder_->PutAudio(dest, n, GetChannels(), GetRate());
+		return n;
+	}
 
 	int avail = source_->GetAvail();
 	
@@ -305,6 +312,8 @@ int SoundDumpPipe::Get(Sample* dest, int samples)
 	{
 		Dump(dest, actual_samples);
 	}
+	if (recorder_)
+		recorder_->PutAudio(dest, actual_samples, GetChannels(), GetRate());
 
 	return actual_samples;
 }
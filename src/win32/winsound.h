@@ -15,6 +15,7 @@
 
 class PC88;
 class OPNMonitor;
+class VideoRecorder;
 
 class SoundDumpPipe : public SoundSource
 {
@@ -25,6 +26,10 @@ public:
 	{ 
 		source_ = source; 
 	}
+	void SetRecorder(VideoRecorder* recorder)
+	{
+		recorder_ = recorder;
+	}
 	ulong GetRate()
 	{
 		return source_ ? source_->GetRate() : 0;
@@ -52,6 +57,7 @@ private:
 	void Dump(Sample* dest, int samples);
 
 	SoundSource* source_;
+	VideoRecorder* recorder_;		// 録画中の音声の送り先
 	string dumpfile_;
 
 	HMMIO hmmio_;					// mmio handle
@@ -84,6 +90,7 @@ public:
 	bool DumpBegin(char* filename);
 	bool DumpEnd();
 	bool IsDumping() { return dumper.IsDumping(); }
+	void SetVideoRecorder(VideoRecorder* rec) { dumper.SetRecorder(rec); }
 	
 	void SetSoundMonitor(OPNMonitor* mon) { soundmon = mon; }
 	